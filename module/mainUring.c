@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+
+#include "synchmess-ioctl.h"
+
+//needs Linux 6.7 or newer built with CONFIG_IO_URING, no liburing: the ring is set up with the raw system calls
+//this is a userspace application to test SYNCHMESS_URING_RECEIVE, SYNCHMESS_URING_RECEIVE_BATCH and
+//SYNCHMESS_URING_BARRIER_WAIT: each command is submitted first, so it waits in the kernel until the
+//group is ready, and completes after the write or AWAKE_BARRIER. At last a waiting command is canceled
+//by closing the ring, and the message it waited for is still there for read
+
+struct ring {
+    int fd;
+    //the mappings hold the ring too, it exits when they are unmapped and fd is closed
+    void *sq;
+    size_t sq_size;
+    void *cq;
+    size_t cq_size;
+    size_t sqes_size;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+int ring_setup(struct ring *ring, unsigned int entries)
+{
+    struct io_uring_params p;
+    char *sq;
+    char *cq;
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(ring->fd < 0) {
+        return -1;
+    }
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sq = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    cq = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        return -1;
+    }
+    ring->sq = sq;
+    ring->cq = cq;
+    ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+//unmap and close the ring, the commands still waiting are canceled
+void ring_exit(struct ring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->cq, ring->cq_size);
+    munmap(ring->sq, ring->sq_size);
+    close(ring->fd);
+}
+
+//submit a command of the group, user_data is the command itself
+int ring_submit(struct ring *ring, int fd_group, unsigned int cmd_op, void *addr, unsigned int len)
+{
+    unsigned int tail = *ring->sq_tail;
+    unsigned int index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->fd = fd_group;
+    sqe->cmd_op = cmd_op;
+    sqe->addr = (unsigned long long)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->user_data = cmd_op;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0);
+}
+
+//completion of the next command, with wait it blocks until there is one. Returns -1 if there is none
+int ring_complete(struct ring *ring, int wait, unsigned long long *user_data)
+{
+    unsigned int head = *ring->cq_head;
+    struct io_uring_cqe *cqe;
+    int res;
+
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        if(!wait) {
+            return -1;
+        }
+        syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return res;
+}
+
+//wait the completion of cmd_op and check its result, a negative res accepts any result above 0
+void expect_completion(struct ring *ring, unsigned int cmd_op, int res)
+{
+    unsigned long long user_data;
+    int ret = ring_complete(ring, 1, &user_data);
+
+    printf("command %llu completed with %d\n", user_data, ret);
+    if(user_data != cmd_op || (res >= 0 && ret != res) || (res < 0 && ret < 1)) {
+        fprintf(stderr, "Expected command %u to complete with %d.\n", cmd_op, res);
+        exit(EXIT_FAILURE);
+    }
+}
+
+//check the command just submitted is waiting in the kernel
+void expect_pending(struct ring *ring, unsigned int cmd_op)
+{
+    unsigned long long user_data;
+
+    usleep(100000);
+    if(ring_complete(ring, 0, &user_data) != -1) {
+        fprintf(stderr, "Command %u completed before the group was ready.\n", cmd_op);
+        exit(EXIT_FAILURE);
+    }
+    printf("command %u is waiting\n", cmd_op);
+}
+
+int main(void) {
+    ioctl_info info;
+    batch_info batch;
+    struct ring ring;
+    char buf[256];
+    int ret;
+
+	int fd = open("/dev/synchmess", O_RDONLY);
+
+	if(fd < 0) {
+		perror("Error opening /dev/synchmess");
+		exit(EXIT_FAILURE);
+	}
+
+    memset(&info, 0, sizeof(info));
+    snprintf(info.group.name,sizeof(info.group.name),"uring");
+	ioctl(fd, IOCTL_INSTALL_GROUP, &info);
+    printf("%s\n", info.file_path);
+
+    int fd_group = open(info.file_path, O_RDWR);
+    if(fd_group < 0) {
+        perror("Error opening the group");
+        exit(EXIT_FAILURE);
+    }
+    if(ring_setup(&ring, 8) < 0) {
+        perror("Error setting up io_uring");
+        exit(EXIT_FAILURE);
+    }
+
+    //RECEIVE completes with the bytes read
+    memset(buf, 0, sizeof(buf));
+    ring_submit(&ring, fd_group, SYNCHMESS_URING_RECEIVE, buf, sizeof(buf));
+    expect_pending(&ring, SYNCHMESS_URING_RECEIVE);
+    write(fd_group, "First write", strlen("First write"));
+    expect_completion(&ring, SYNCHMESS_URING_RECEIVE, strlen("First write"));
+    printf("received %s\n", buf);
+
+    //RECEIVE_BATCH completes with at least one message, the rest is left to read
+    memset(&batch, 0, sizeof(batch));
+    batch.buf = (unsigned long long)(uintptr_t)buf;
+    batch.len = sizeof(buf);
+    batch.max_messages = 2;
+    ring_submit(&ring, fd_group, SYNCHMESS_URING_RECEIVE_BATCH, &batch, 0);
+    expect_pending(&ring, SYNCHMESS_URING_RECEIVE_BATCH);
+    write(fd_group, "Second write", strlen("Second write"));
+    write(fd_group, "Third write", strlen("Third write"));
+    expect_completion(&ring, SYNCHMESS_URING_RECEIVE_BATCH, -1);
+    printf("received %u messages in a batch\n", batch.messages);
+    if(batch.messages < 2) {
+        ret = read(fd_group, buf, sizeof(buf));
+        printf("read %d bytes left after the batch\n", ret);
+    }
+
+    //BARRIER_WAIT completes with 0 at AWAKE_BARRIER
+    ring_submit(&ring, fd_group, SYNCHMESS_URING_BARRIER_WAIT, NULL, 0);
+    expect_pending(&ring, SYNCHMESS_URING_BARRIER_WAIT);
+    ioctl(fd_group, AWAKE_BARRIER);
+    expect_completion(&ring, SYNCHMESS_URING_BARRIER_WAIT, 0);
+
+    //a RECEIVE still waiting when the ring is closed is canceled, it does not take the next message
+    ring_submit(&ring, fd_group, SYNCHMESS_URING_RECEIVE, buf, sizeof(buf));
+    expect_pending(&ring, SYNCHMESS_URING_RECEIVE);
+    ring_exit(&ring);
+    usleep(100000);
+    write(fd_group, "Last write", strlen("Last write"));
+    memset(buf, 0, sizeof(buf));
+    ret = read(fd_group, buf, sizeof(buf));
+    printf("read %d bytes after the ring was closed: %s\n", ret, buf);
+    if(ret != (int)strlen("Last write")) {
+        fprintf(stderr, "The canceled command took the message.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("io_uring commands completed and canceled as expected\n");
+    close(fd_group);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,1033 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <linux/sched.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+//signal_pending moved out of sched.h in 4.11
+#include <linux/sched/signal.h>
+#endif
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+
+#include "synchmess-core.h"
+
+//the parameters keep their names in /sys/module/synchmess/parameters, the variables are prefixed
+//because a built-in module shares the symbols of the kernel
+int synchmess_max_storage_size = 500;
+module_param_named(max_storage_size,synchmess_max_storage_size,int,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH);
+MODULE_PARM_DESC(max_storage_size,"The maximum number of bytes globally allowed for keeping messages in the device file");
+
+//a spin keeps a cpu busy, so a group cannot spin longer than a sleep and a wake up cost by much
+unsigned long synchmess_max_spin_ns = 100000;
+module_param_named(max_spin_ns,synchmess_max_spin_ns,ulong,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH);
+MODULE_PARM_DESC(max_spin_ns,"The maximum time (ns) allowed for the spin of the waiters of a group before they sleep");
+
+static void workqueue_write(struct work_struct *work);
+static void group_ring_pop(struct group_dev *entry);
+
+//init a queue of messages
+static void message_queue_init(struct message_queue *queue){
+    int i;
+    
+    for(i = 0; i < SYNCHMESS_PRIORITIES; i++){
+        INIT_LIST_HEAD(&queue->lanes[i]);
+    }
+    queue->lane_bitmap = 0;
+}
+
+//add a message at the tail (or at the head) of its lane. Called with group_lock held
+static void message_queue_add(struct group_dev *entry, struct message_queue *queue, struct message_t *message, bool head){
+    if(head){
+        list_add(&message->list, &queue->lanes[message->priority]);
+        list_add(&message->age_list, &entry->age_list);
+    } else {
+        list_add_tail(&message->list, &queue->lanes[message->priority]);
+        list_add_tail(&message->age_list, &entry->age_list);
+    }
+    message->queue = queue;
+    if(message->droppable){
+        entry->droppable++;
+    }
+    __set_bit(message->priority, &queue->lane_bitmap);
+    entry->lane_depth[message->priority]++;
+    entry->storage_bytes += message->len;
+}
+
+//remove a message from its queue. Called with group_lock held
+static void message_queue_remove(struct group_dev *entry, struct message_t *message){
+    struct message_queue *queue = message->queue;
+    
+    list_del(&message->list);
+    list_del(&message->age_list);
+    if(message->droppable){
+        entry->droppable--;
+    }
+    if(list_empty(&queue->lanes[message->priority])){
+        __clear_bit(message->priority, &queue->lane_bitmap);
+    }
+    entry->lane_depth[message->priority]--;
+    entry->storage_bytes -= message->len;
+}
+
+//first message of the highest non-empty lane, NULL if the queue is empty. Called with group_lock held
+static struct message_t *message_queue_first(struct message_queue *queue){
+    int lane = message_queue_top(queue);
+    
+    if(lane < 0){
+        return NULL;
+    }
+    return list_first_entry(&queue->lanes[lane], struct message_t, list);
+}
+
+//remove the first message of the highest non-empty lane. Called with group_lock held
+static struct message_t *message_queue_pop(struct group_dev *entry, struct message_queue *queue){
+    struct message_t *message = message_queue_first(queue);
+    
+    if(message != NULL){
+        message_queue_remove(entry, message);
+    }
+    return message;
+}
+
+//free the messages older than the TTL of the group, they are the first ones of age_list.
+//Returns the bytes freed. Called with group_lock held
+size_t synchgroup_expire_messages(struct group_dev *entry){
+    struct message_t *message;
+    struct ring_record *record;
+    u64 pos = entry->ring_head;
+    size_t freed = 0;
+    u64 now;
+    
+    if(entry->ttl_ns == 0){
+        return 0;
+    }
+    now = ktime_get_ns();
+    //the records of the ring are in the order they were stored too. The first one stays while a reader copies it
+    while(entry->ring != NULL && !entry->ring_reading && (record = synchgroup_ring_next(entry, &pos)) != NULL){
+        if(!group_message_expired(entry, record->visible_ns, now)){
+            break;
+        }
+        freed += record->len;
+        group_ring_pop(entry);
+        pos = entry->ring_head;
+        entry->expired++;
+    }
+    while(!list_empty(&entry->age_list)){
+        message = list_first_entry(&entry->age_list, struct message_t, age_list);
+        if(!group_message_expired(entry, message->visible_ns, now)){
+            break;
+        }
+        message_queue_remove(entry, message);
+        freed += message->len;
+        message_free(message);
+        entry->expired++;
+    }
+    return freed;
+}
+
+//queue of messages read by the session, NULL if there is nothing to read. Called with group_lock held
+static struct message_queue *session_message_queue(struct synchgroup_session *session){
+    struct group_dev *entry = session->group;
+    struct message_queue *queue = NULL;
+    int i;
+    int partition;
+    int lane;
+    int top = -1;
+    
+    if(session->partition_mask == 0){
+        if(message_queue_top(&entry->message_list) < 0){
+            return NULL;
+        }
+        return &entry->message_list;
+    }
+    
+    //the partition with the highest lane is drained, round robin among partitions with the same lane
+    for(i = 1; i <= SYNCHMESS_PARTITIONS; i++){
+        partition = (session->last_partition + i) % SYNCHMESS_PARTITIONS;
+        if(!(session->partition_mask & (1UL << partition))){
+            continue;
+        }
+        lane = message_queue_top(&entry->partition_list[partition]);
+        if(lane > top){
+            top = lane;
+            queue = &entry->partition_list[partition];
+        }
+    }
+    if(queue != NULL){
+        session->last_partition = queue - entry->partition_list;
+    }
+    return queue;
+}
+
+//true if the session has a message to read. Called with group_lock held
+bool synchgroup_has_messages(struct synchgroup_session *session){
+    struct group_dev *entry = session->group;
+    int i;
+    
+    if(session->partition_mask == 0){
+        if(entry->ring != NULL){
+            return entry->ring_head != entry->ring_tail;
+        }
+        return message_queue_top(&entry->message_list) >= 0;
+    }
+    for(i = 0; i < SYNCHMESS_PARTITIONS; i++){
+        if((session->partition_mask & (1UL << i)) && message_queue_top(&entry->partition_list[i]) >= 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+//ring_copy_t for kernel memory
+int synchmess_ring_copy_kernel(void *dst, const void *src, size_t len){
+    memcpy(dst, src, len);
+    return 0;
+}
+
+//bytes of a ring for the current max_storage_size, at least a page. A negative or zero
+//max_storage_size gets a page too, roundup_pow_of_two is undefined for 0
+static size_t group_ring_size(void){
+    size_t quota = max(synchmess_max_storage_size, 0);
+    
+    return roundup_pow_of_two(max_t(size_t, PAGE_SIZE, quota * RING_SIZE_FACTOR));
+}
+
+//store messages in a ring instead of message_list, or go back to message_list. The ring is sized
+//from max_storage_size when it is enabled. The group must be empty. Called with group_lock held
+int synchgroup_set_ring(struct group_dev *entry, bool enable){
+    int i;
+    size_t size;
+    
+    if(enable == (entry->ring != NULL)){
+        return 0;
+    }
+    //the messages would be split between the queues and the ring
+    if(entry->storage_bytes || entry->delayed){
+        return -EBUSY;
+    }
+    for(i = 0; i < SYNCHMESS_PRIORITIES; i++){
+        if(entry->lane_depth[i]){
+            return -EBUSY;
+        }
+    }
+    if(!enable){
+        kvfree(entry->ring);
+        entry->ring = NULL;
+        return 0;
+    }
+    size = group_ring_size();
+    entry->ring = kvmalloc(size, SYNCHMESS_GFP);
+    if(entry->ring == NULL){
+        return -ENOMEM;
+    }
+    entry->ring_size = size;
+    entry->ring_grow_failed = 0;
+    entry->ring_head = 0;
+    entry->ring_tail = 0;
+    return 0;
+}
+
+//replace the ring of an empty group with a larger one if max_storage_size has grown since it was
+//allocated. On failure the group keeps its ring, and the same size is not tried again, so a send
+//does not wait for a large allocation that already failed. Called with group_lock held
+static void group_ring_grow(struct group_dev *entry){
+    size_t size = group_ring_size();
+    char *ring;
+    
+    if(size <= entry->ring_size || size == entry->ring_grow_failed || entry->ring_head != entry->ring_tail){
+        return;
+    }
+    //the group can go on with its ring, so the allocation does not try hard
+    ring = kvmalloc(size, SYNCHMESS_GFP | __GFP_NORETRY | __GFP_NOWARN);
+    if(ring == NULL){
+        entry->ring_grow_failed = size;
+        return;
+    }
+    entry->ring_grow_failed = 0;
+    kvfree(entry->ring);
+    entry->ring = ring;
+    entry->ring_size = size;
+    entry->ring_head = 0;
+    entry->ring_tail = 0;
+}
+
+//append a record and its body at the tail of the ring, the body is copied from src by copy.
+//A record never wraps around: if it does not fit at the end of the ring, the end is marked unused
+//and the record is stored at the start. Called with group_lock held
+static int group_ring_append(struct group_dev *entry, struct ring_record *record, const void *src, ring_copy_t copy){
+    size_t size = RING_RECORD_SIZE(record->len);
+    size_t offset;
+    size_t skip = 0;
+    char *dst;
+    int err;
+    
+    //check if max_storage_size is reached
+    if(entry->storage_bytes + record->len > synchmess_max_storage_size){
+        return -ENOSPC;
+    }
+    group_ring_grow(entry);
+    offset = entry->ring_tail & (entry->ring_size - 1);
+    if(offset + size > entry->ring_size){
+        skip = entry->ring_size - offset;
+    }
+    //the ring can be full before the quota with very small messages, see RING_SIZE_FACTOR
+    if(entry->ring_tail + skip + size - entry->ring_head > entry->ring_size){
+        return -ENOSPC;
+    }
+    dst = entry->ring + (skip ? 0 : offset);
+    //nothing is changed until the body is copied, so a failed copy leaves the ring as it was
+    err = copy(dst + sizeof(*record), src, record->len);
+    if(err){
+        return err;
+    }
+    if(skip){
+        ((struct ring_record *)(entry->ring + offset))->len = RING_RECORD_WRAP;
+    }
+    memcpy(dst, record, sizeof(*record));
+    entry->ring_tail += skip + size;
+    entry->lane_depth[0]++;
+    entry->storage_bytes += record->len;
+    return 0;
+}
+
+//record at *pos, then *pos is moved to the next one. NULL at the end of the ring. Called with group_lock held
+struct ring_record *synchgroup_ring_next(struct group_dev *entry, u64 *pos){
+    struct ring_record *record;
+    size_t offset;
+    
+    if(*pos == entry->ring_tail){
+        return NULL;
+    }
+    offset = *pos & (entry->ring_size - 1);
+    record = (struct ring_record *)(entry->ring + offset);
+    if(record->len == RING_RECORD_WRAP){
+        //the next record is at the start of the ring
+        *pos += entry->ring_size - offset;
+        record = (struct ring_record *)entry->ring;
+    }
+    *pos += RING_RECORD_SIZE(record->len);
+    return record;
+}
+
+//remove the first record of the ring, dequeue is only a move of the head. Called with group_lock held
+static void group_ring_pop(struct group_dev *entry){
+    u64 pos = entry->ring_head;
+    struct ring_record *record = synchgroup_ring_next(entry, &pos);
+    
+    entry->ring_head = pos;
+    entry->lane_depth[0]--;
+    entry->storage_bytes -= record->len;
+    //an empty ring starts again from the beginning, which is likely still in cache
+    if(entry->ring_head == entry->ring_tail){
+        entry->ring_head = 0;
+        entry->ring_tail = 0;
+    }
+}
+
+//copy a message in the ring and free it, the ring has no partitions and no priorities.
+//Called with group_lock held
+static int group_ring_store_message(struct group_dev *entry, struct message_t *message, int partition){
+    struct ring_record record;
+    int err;
+    
+    if(partition >= 0 || message->priority > 0){
+        return -EINVAL;
+    }
+    record.len = message->len;
+    record.tgid = message->tgid;
+    record.tid = message->tid;
+    record.reserved = 0;
+    record.seq = message->seq;
+    record.enqueue_ns = message->enqueue_ns;
+    record.visible_ns = message->visible_ns;
+    err = group_ring_append(entry, &record, message->text, synchmess_ring_copy_kernel);
+    if(err){
+        return err;
+    }
+    message_free(message);
+    return 0;
+}
+
+//add a message to the right queue of the group, the group takes the ownership of the message
+//unless an error is returned. Called with group_lock held
+static int group_enqueue_message(struct group_dev *entry, struct message_t *message, int partition){
+    int err;
+    
+    //expired messages free their storage before the check
+    synchgroup_expire_messages(entry);
+    
+    //check if max_storage_size is reached
+    if(entry->storage_bytes + message->len > synchmess_max_storage_size){
+        printk(KERN_ERR "%s: Maximum storage size reached\n", KBUILD_MODNAME);
+        return -ENOSPC;
+    }
+    
+    message->visible_ns = ktime_get_ns();
+    
+    if(entry->ring != NULL){
+        err = group_ring_store_message(entry, message, partition);
+        if(err){
+            return err;
+        }
+        //wake up poll and WAIT_ANY callers
+        wake_up_interruptible(&entry->read_queue);
+        return 0;
+    }
+    
+    //if there is space enough, add the message to the queue
+    if(partition < 0){
+        message_queue_add(entry, &entry->message_list, message, false);
+    } else {
+        message_queue_add(entry, &entry->partition_list[partition], message, false);
+    }
+    //wake up poll and WAIT_ANY callers
+    wake_up_interruptible(&entry->read_queue);
+    return 0;
+}
+
+//free all the messages stored in the group. Called with group_lock held
+static void group_free_messages(struct group_dev *entry){
+    struct message_t *entry_message;
+    struct message_queue *queue;
+    int i;
+    
+    //the unkeyed messages and then each partition
+    for(i = -1; i < SYNCHMESS_PARTITIONS; i++){
+        queue = i < 0 ? &entry->message_list : &entry->partition_list[i];
+        while((entry_message = message_queue_pop(entry, queue)) != NULL){
+            //free memory
+            message_free(entry_message);
+        }
+    }
+}
+
+//add params to the list of delayed writes, sorted by deadline. Called with group_lock held
+static void group_add_delayed(struct group_dev *entry, struct delayed_work_params *params){
+    struct delayed_work_params *entry_params;
+    
+    if(params->message->droppable){
+        entry->droppable++;
+    }
+    entry->delayed++;
+    if(params->owner != NULL){
+        //the list of the sender is sorted too, so it is flushed in deadline order
+        list_for_each_entry_reverse(entry_params, &params->owner->delayed, owner_list){
+            if(entry_params->deadline <= params->deadline){
+                break;
+            }
+        }
+        list_add(&params->owner_list, &entry_params->owner_list);
+    }
+    //deadlines are usually increasing, so the list is scanned from the tail
+    list_for_each_entry_reverse(entry_params, &entry->delayed_work_param_list, list){
+        if(entry_params->deadline <= params->deadline){
+            list_add(&params->list, &entry_params->list);
+            return;
+        }
+    }
+    list_add(&params->list, &entry->delayed_work_param_list);
+}
+
+//remove params from the list of delayed writes. Called with group_lock held
+static void group_del_delayed(struct group_dev *entry, struct delayed_work_params *params){
+    list_del(&params->list);
+    if(params->owner != NULL){
+        list_del(&params->owner_list);
+    }
+    if(params->message->droppable){
+        entry->droppable--;
+    }
+    entry->delayed--;
+}
+
+//arm the delivery work for the earliest deadline. Called with group_lock held
+void synchgroup_arm_delivery(struct group_dev *entry){
+    struct delayed_work_params *params;
+    u64 now;
+    
+    if(list_empty(&entry->delayed_work_param_list)){
+        cancel_delayed_work(&entry->delivery_work);
+        return;
+    }
+    params = list_first_entry(&entry->delayed_work_param_list, struct delayed_work_params, list);
+    now = ktime_get_ns();
+    if(params->deadline <= now){
+        mod_delayed_work(entry->wq, &entry->delivery_work, 0);
+    } else {
+        //nsecs_to_jiffies rounds down, one more jiffy so the work never runs before the deadline.
+        //usecs_to_jiffies would truncate the delay to 32 bits, a longer delay than MAX_JIFFY_OFFSET
+        //runs the work early and it is armed again
+        mod_delayed_work(entry->wq, &entry->delivery_work, min_t(u64, nsecs_to_jiffies64(params->deadline - now) + 1, MAX_JIFFY_OFFSET));
+    }
+}
+
+//remove params from the list of delayed writes and store (or revoke) its message. Called with group_lock held
+static void group_release_delayed(struct group_dev *entry, struct delayed_work_params *params, bool revoke){
+    group_del_delayed(entry, params);
+    if(revoke || group_enqueue_message(entry, params->message, params->partition)){
+        message_free(params->message);
+    }
+    kfree(params);
+}
+
+//store (or revoke) the delayed messages with deadline in [from, to], in deadline order.
+//Returns the number of messages removed from the delayed list. Called with group_lock held
+long synchgroup_flush_delayed(struct group_dev *entry, u64 from, u64 to, bool revoke){
+    struct delayed_work_params *params;
+    struct delayed_work_params *tmp;
+    long ret = 0;
+    
+    list_for_each_entry_safe(params, tmp, &entry->delayed_work_param_list, list){
+        if(params->deadline > to){
+            //the list is sorted, no other message is in the range
+            break;
+        }
+        if(params->deadline < from){
+            continue;
+        }
+        group_release_delayed(entry, params, revoke);
+        ret++;
+    }
+    return ret;
+}
+
+//store (or revoke) the delayed messages sent by session, in deadline order. The other delayed messages
+//are not scanned. Returns the number of messages removed from the delayed list. Called with group_lock held
+long synchgroup_flush_session_delayed(struct synchgroup_session *session, bool revoke){
+    struct delayed_work_params *params;
+    struct delayed_work_params *tmp;
+    long ret = 0;
+    
+    list_for_each_entry_safe(params, tmp, &session->delayed, owner_list){
+        group_release_delayed(session->group, params, revoke);
+        ret++;
+    }
+    return ret;
+}
+
+//the delayed messages sent by session stay delayed, without an owner. Called with group_lock held
+void synchgroup_detach_session(struct synchgroup_session *session){
+    struct delayed_work_params *params;
+    struct delayed_work_params *tmp;
+    
+    list_for_each_entry_safe(params, tmp, &session->delayed, owner_list){
+        list_del(&params->owner_list);
+        params->owner = NULL;
+    }
+}
+
+//store a restored message, keeping its visible_ns, so its TTL is not extended.
+//Readers are woken up once by the caller after the whole group. Called with group_lock held
+int synchgroup_restore_message(struct group_dev *entry, struct message_t *message, int partition){
+    if(entry->storage_bytes + message->len > synchmess_max_storage_size){
+        return -ENOSPC;
+    }
+    if(entry->ring != NULL){
+        return group_ring_store_message(entry, message, partition);
+    }
+    if(partition < 0){
+        message_queue_add(entry, &entry->message_list, message, false);
+    } else {
+        message_queue_add(entry, &entry->partition_list[partition], message, false);
+    }
+    return 0;
+}
+
+//add a restored delayed message. Restored messages come in deadline order, so each one is added
+//at the tail in constant time. The caller arms the delivery work. Called with group_lock held
+int synchgroup_restore_delayed(struct group_dev *entry, struct message_t *message, int partition, u64 deadline){
+    struct delayed_work_params *params;
+    
+    params = kmalloc(sizeof(*params),SYNCHMESS_GFP);
+    if(params == NULL){
+        return -ENOMEM;
+    }
+    params->message = message;
+    params->partition = partition;
+    params->deadline = deadline;
+    //the file that sent it is gone
+    params->owner = NULL;
+    group_add_delayed(entry, params);
+    return 0;
+}
+
+//free up to nr droppable messages of the group, stored ones first (oldest first) and then delayed ones
+//(latest deadline first). Returns the number of messages freed and adds their size to bytes. Called with group_lock held
+unsigned long synchgroup_reclaim_messages(struct group_dev *entry, unsigned long nr, size_t *bytes){
+    struct message_t *message;
+    struct message_t *tmp;
+    struct delayed_work_params *params;
+    struct delayed_work_params *tmp_params;
+    unsigned long freed = 0;
+    
+    list_for_each_entry_safe(message, tmp, &entry->age_list, age_list){
+        if(freed == nr || entry->droppable == 0){
+            return freed;
+        }
+        if(message->droppable){
+            message_queue_remove(entry, message);
+            *bytes += message->len;
+            message_free(message);
+            freed++;
+        }
+    }
+    list_for_each_entry_safe_reverse(params, tmp_params, &entry->delayed_work_param_list, list){
+        if(freed == nr || entry->droppable == 0){
+            break;
+        }
+        if(params->message->droppable){
+            group_del_delayed(entry, params);
+            *bytes += params->message->len;
+            message_free(params->message);
+            kfree(params);
+            freed++;
+        }
+    }
+    synchgroup_arm_delivery(entry);
+    return freed;
+}
+
+/*Workqueue Function*/
+static void workqueue_write(struct work_struct *work){
+    struct group_dev *entry;
+
+    entry = container_of(to_delayed_work(work), struct group_dev, delivery_work);
+    printk(KERN_INFO "%s: workqueue_write: Executing Workqueue Function, minor = %d\n", KBUILD_MODNAME, MINOR(entry->devt));
+    
+    //to enable concurrent access
+    mutex_lock(&entry->group_lock);
+    
+    //store the messages whose deadline is expired and wait for the next one
+    synchgroup_flush_delayed(entry, 0, ktime_get_ns(), false);
+    synchgroup_arm_delivery(entry);
+    
+    mutex_unlock(&entry->group_lock);
+    return;
+}
+
+//init a group with the given name, it is not added to any list of groups
+int synchgroup_init(struct group_dev *entry, const char *name, dev_t devt){
+    char wq_name[32];
+    int i;
+    
+    //group name
+    snprintf(entry->group_dev_name, sizeof(entry->group_dev_name), "synch!synchgroup_%s", name);
+    //device number
+    entry->devt = devt;
+    //default timeout for a group
+    entry->timeout_millis = 0;
+    
+    //init the queue of messages in the group
+    message_queue_init(&entry->message_list);
+    
+    //init the queues of keyed messages
+    for(i = 0; i < SYNCHMESS_PARTITIONS; i++){
+        message_queue_init(&entry->partition_list[i]);
+    }
+    entry->storage_bytes = 0;
+    memset(entry->lane_depth, 0, sizeof(entry->lane_depth));
+    
+    //messages never expire by default
+    INIT_LIST_HEAD(&entry->age_list);
+    entry->ring = NULL;
+    entry->ring_size = 0;
+    entry->ring_grow_failed = 0;
+    entry->ring_head = 0;
+    entry->ring_tail = 0;
+    entry->ring_reading = false;
+    mutex_init(&entry->ring_read_lock);
+    entry->ttl_ns = 0;
+    entry->expired = 0;
+    entry->droppable = 0;
+    entry->reclaimed = 0;
+    
+    //no header before the messages by default
+    entry->next_seq = 0;
+    entry->read_header = false;
+    
+    //init the first element of delayed_work_param list in the group
+    INIT_LIST_HEAD(&entry->delayed_work_param_list);
+    entry->delayed = 0;
+    
+    //init the mutex to access the group
+    mutex_init(&entry->group_lock);
+    
+    //name of the workqueue is the device group name
+    snprintf(wq_name,sizeof(wq_name),"synchgroup_%s",name);
+    //create the workqueue where delayed work will be executed
+    entry->wq = create_workqueue(wq_name);
+    if(entry->wq == NULL){
+        return -ENOMEM;
+    }
+    INIT_DELAYED_WORK(&entry->delivery_work, workqueue_write);
+    
+    //init the wait queue to manage sleep on and awake barrier
+    init_waitqueue_head (&entry->sleep_queue);
+    entry->barrier_generation = 0;
+    
+    //the waiters sleep at once by default
+    entry->spin_ns = 0;
+    entry->spin_rate = SPIN_RATE_ONE;
+    atomic_long_set(&entry->spin_skipped, 0);
+    atomic_long_set(&entry->spin_attempts, 0);
+    atomic_long_set(&entry->spin_hits, 0);
+    
+    //init the wait queue woken up by new messages
+    init_waitqueue_head (&entry->read_queue);
+    return 0;
+}
+
+//free all the messages of a group and stop its delayed writes
+void synchgroup_destroy(struct group_dev *entry){
+    //stop the delivery of delayed messages
+    cancel_delayed_work_sync(&entry->delivery_work);
+    
+    //to enable concurrent access
+    mutex_lock(&entry->group_lock);
+    
+    //free each message in the group
+    group_free_messages(entry);
+    
+    //free each delayed message
+    synchgroup_flush_delayed(entry, 0, U64_MAX, true);
+    
+    //free the ring with the messages in it
+    kvfree(entry->ring);
+    entry->ring = NULL;
+    
+    mutex_unlock(&entry->group_lock);
+    
+    destroy_workqueue(entry->wq);
+}
+
+//init a reader of the unkeyed messages of a group
+void synchgroup_session_init(struct synchgroup_session *session, struct group_dev *entry){
+    session->group = entry;
+    session->partition_mask = 0;
+    session->last_partition = SYNCHMESS_PARTITIONS - 1;
+    INIT_LIST_HEAD(&session->delayed);
+}
+
+//allocate a message with a body of len bytes, to be filled by the caller
+struct message_t *synchmess_message_alloc(size_t len, int priority, bool droppable){
+    struct message_t *message;
+    
+    message = kmalloc(sizeof(*message),SYNCHMESS_GFP);
+    if(message == NULL){
+        return NULL;
+    }
+    message->text = kmalloc(len + 1,SYNCHMESS_GFP);
+    if(message->text == NULL){
+        kfree(message);
+        return NULL;
+    }
+    message->text[len] = 0;
+    message->len = len;
+    message->priority = priority;
+    message->droppable = droppable;
+    return message;
+}
+
+//store a message in the group, or delay it until deadline. Partition -1 means unkeyed.
+//The message gets its sequence number and sender even if it is then dropped.
+//The group takes the ownership of the message, it is freed on error
+int synchgroup_send_message(struct group_dev *entry, struct message_t *message, int partition, u64 deadline, struct synchgroup_session *owner){
+    int err;
+    //params for the delayed write
+    struct delayed_work_params *params;
+    
+    message->enqueue_ns = ktime_get_ns();
+    //the ids of the initial namespace, each reader translates them to its own namespace
+    message->tgid = current->tgid;
+    message->tid = current->pid;
+    
+    if(deadline <= message->enqueue_ns){
+        //no delay, the message is stored immediately
+        if(mutex_lock_interruptible(&entry->group_lock)){
+            message_free(message);
+            return -ERESTARTSYS;
+        }
+        //a message dropped because the storage is full leaves a gap in the sequence
+        message->seq = entry->next_seq++;
+        err = group_enqueue_message(entry, message, partition);
+        mutex_unlock(&entry->group_lock);
+        if(err){
+            message_free(message);
+        }
+        return err;
+    }
+    
+    params = kmalloc(sizeof(*params),SYNCHMESS_GFP);
+    if(params == NULL){
+        message_free(message);
+        return -ENOMEM;
+    }
+    params->message = message;
+    params->partition = partition;
+    params->deadline = deadline;
+    params->owner = owner;
+    
+    //to enable concurrent access
+    if(mutex_lock_interruptible(&entry->group_lock)){
+        message_free(message);
+        kfree(params);
+        return -ERESTARTSYS;
+    }
+    message->seq = entry->next_seq++;
+    group_add_delayed(entry, params);
+    //rearm the delivery work if this is the new earliest deadline
+    if(entry->delayed_work_param_list.next == &params->list){
+        synchgroup_arm_delivery(entry);
+    }
+    mutex_unlock(&entry->group_lock);
+    return 0;
+}
+
+//store a message without delay in the ring of the group, the body is copied from src by copy, under
+//group_lock, so nothing is allocated and src must not be user memory. Returns -ENOENT if the group has no ring
+int synchgroup_ring_send(struct group_dev *entry, const void *src, size_t len, ring_copy_t copy){
+    struct ring_record record;
+    int err;
+    
+    record.len = len;
+    record.tgid = current->tgid;
+    record.tid = current->pid;
+    record.reserved = 0;
+    record.enqueue_ns = ktime_get_ns();
+    record.visible_ns = record.enqueue_ns;
+    
+    if(mutex_lock_interruptible(&entry->group_lock)){
+        return -ERESTARTSYS;
+    }
+    if(entry->ring == NULL){
+        mutex_unlock(&entry->group_lock);
+        return -ENOENT;
+    }
+    //expired messages free their storage before the check
+    synchgroup_expire_messages(entry);
+    //a message dropped because the storage is full leaves a gap in the sequence
+    record.seq = entry->next_seq++;
+    err = group_ring_append(entry, &record, src, copy);
+    mutex_unlock(&entry->group_lock);
+    if(err == -ENOSPC){
+        printk(KERN_ERR "%s: Maximum storage size reached\n", KBUILD_MODNAME);
+    }
+    if(err == 0){
+        //wake up poll and WAIT_ANY callers
+        wake_up_interruptible(&entry->read_queue);
+    }
+    return err;
+}
+
+//pass the first message of the ring to read and remove it if read succeeds, so a message is
+//consumed exactly once. read runs without group_lock, so it can copy to the user: the readers of
+//the ring take turns on ring_read_lock, and while one of them reads, ring_reading keeps the first
+//record in place. Senders only append after it and the ring cannot be resized or disabled while
+//it is not empty. Returns what read returns, -ENODATA if the ring is empty and -ENOENT if the group has no ring
+ssize_t synchgroup_ring_read(struct group_dev *entry, ring_read_t read, void *data){
+    struct ring_record *record;
+    u64 pos;
+    ssize_t ret;
+    
+    if(mutex_lock_interruptible(&entry->ring_read_lock)){
+        return -ERESTARTSYS;
+    }
+    if(mutex_lock_interruptible(&entry->group_lock)){
+        mutex_unlock(&entry->ring_read_lock);
+        return -ERESTARTSYS;
+    }
+    if(entry->ring == NULL){
+        ret = -ENOENT;
+        goto out_unlock;
+    }
+    //expired messages are removed before choosing the message to read
+    synchgroup_expire_messages(entry);
+    pos = entry->ring_head;
+    record = synchgroup_ring_next(entry, &pos);
+    if(record == NULL){
+        ret = -ENODATA;
+        goto out_unlock;
+    }
+    entry->ring_reading = true;
+    mutex_unlock(&entry->group_lock);
+    
+    ret = read(data, record, (const char *)(record + 1));
+    
+    mutex_lock(&entry->group_lock);
+    entry->ring_reading = false;
+    if(ret >= 0){
+        group_ring_pop(entry);
+    }
+out_unlock:
+    mutex_unlock(&entry->group_lock);
+    mutex_unlock(&entry->ring_read_lock);
+    return ret;
+}
+
+//remove the next message of the session, NULL if there is nothing to read
+struct message_t *synchgroup_read_message(struct synchgroup_session *session){
+    return synchgroup_read_message_max(session, SIZE_MAX);
+}
+
+//remove the next message of the session if it is at most max_len bytes. The length is checked under
+//group_lock, so a message that does not fit keeps its place in the queue
+struct message_t *synchgroup_read_message_max(struct synchgroup_session *session, size_t max_len){
+    struct group_dev *entry = session->group;
+    //queue of messages to read from
+    struct message_queue *queue;
+    struct message_t *message = NULL;
+    
+    //to enable concurrent access
+    if(mutex_lock_interruptible(&entry->group_lock)){
+        return ERR_PTR(-ERESTARTSYS);
+    }
+    
+    //expired messages are removed before choosing the message to read
+    synchgroup_expire_messages(entry);
+    queue = session_message_queue(session);
+    if(queue != NULL){
+        //get the first message of the highest lane and remove it from the queue
+        message = message_queue_first(queue);
+        if(message->len > max_len){
+            message = ERR_PTR(-EMSGSIZE);
+        } else {
+            message_queue_remove(entry, message);
+        }
+    }
+    mutex_unlock(&entry->group_lock);
+    return message;
+}
+
+//put back a message removed by synchgroup_read_message at the head of its lane
+void synchgroup_unread_message(struct group_dev *entry, struct message_t *message){
+    mutex_lock(&entry->group_lock);
+    message_queue_add(entry, message->queue, message, true);
+    mutex_unlock(&entry->group_lock);
+}
+
+//copy a message to a batch as message_header and body padded to 8 bytes
+ssize_t synchmess_batch_copy_message(message_header *header, const char *text, void *buf, size_t count, bool first, ring_copy_t copy){
+    size_t len = header->len;
+    int err;
+    
+    if(count < sizeof(*header)){
+        return first ? -EINVAL : -EMSGSIZE;
+    }
+    if(len > count - sizeof(*header)){
+        if(!first){
+            return -EMSGSIZE;
+        }
+        len = count - sizeof(*header);
+    }
+    err = copy(buf, header, sizeof(*header));
+    if(err == 0){
+        err = copy(buf + sizeof(*header), text, len);
+    }
+    if(err){
+        return err;
+    }
+    return min_t(size_t, ALIGN(sizeof(*header) + len, 8), count);
+}
+
+//barrier release awaited by a thread
+struct barrier_wait {
+    struct group_dev *entry;
+    //barrier generation when the wait started
+    unsigned long generation;
+};
+
+static bool barrier_released(void *data){
+    struct barrier_wait *barrier = data;
+    
+    return READ_ONCE(barrier->entry->barrier_generation) != barrier->generation;
+}
+
+//sleep until the next AWAKE_BARRIER on the group
+void synchgroup_barrier_sleep(struct group_dev *entry){
+    wait_queue_t wait;
+    struct barrier_wait barrier;
+    bool released;
+    
+    barrier.entry = entry;
+    barrier.generation = READ_ONCE(entry->barrier_generation);
+    //a release within the spin budget does not need a context switch
+    if(synchgroup_spin_begin(entry)){
+        released = synchmess_spin(READ_ONCE(entry->spin_ns), barrier_released, &barrier);
+        synchgroup_spin_end(entry, released);
+        if(released){
+            return;
+        }
+    }
+    
+    //init a wait queue entry to manage sleep on barrier
+    init_waitqueue_entry(&wait, current);
+    set_current_state(TASK_INTERRUPTIBLE);
+    
+    //add the wait queue entry to the wait queue of the group
+    add_wait_queue(&entry->sleep_queue, &wait);
+    //call schedule to deschedule the actual task until an AWAKE_BARRIER arrives, unless one arrived while spinning
+    if(!barrier_released(&barrier)){
+        schedule();
+    }
+    __set_current_state(TASK_RUNNING);
+    //when an AWAKE_BARRIER arrives remove the wait queue entry from the queue
+    remove_wait_queue (&entry->sleep_queue, &wait);
+}
+
+//wake up all the threads sleeping on the barrier of the group
+void synchgroup_barrier_awake(struct group_dev *entry){
+    //WAIT_ANY callers detect the release from the generation
+    WRITE_ONCE(entry->barrier_generation, entry->barrier_generation + 1);
+    //wake up all tasks in the sleep queue of the group
+    wake_up_all(&entry->sleep_queue);
+}
+
+void synchgroup_set_spin_budget(struct group_dev *entry, u64 spin_ns){
+    //the waiters read it without group_lock
+    WRITE_ONCE(entry->spin_ns, spin_ns);
+    //a new budget starts without the history of the old one
+    WRITE_ONCE(entry->spin_rate, SPIN_RATE_ONE);
+}
+
+//true if a wait on the group has to spin before sleeping
+bool synchgroup_spin_begin(struct group_dev *entry){
+    if(READ_ONCE(entry->spin_ns) == 0){
+        return false;
+    }
+    //a waiter in SPIN_PROBE_INTERVAL spins anyway, to notice when the releases get faster again
+    if(READ_ONCE(entry->spin_rate) < SPIN_RATE_MIN && atomic_long_inc_return(&entry->spin_skipped) % SPIN_PROBE_INTERVAL){
+        return false;
+    }
+    atomic_long_inc(&entry->spin_attempts);
+    return true;
+}
+
+//account the end of a spin, hit if the wait ended while spinning
+void synchgroup_spin_end(struct group_dev *entry, bool hit){
+    unsigned int rate = READ_ONCE(entry->spin_rate);
+    
+    //average over about the last 8 spins, updated without group_lock: a lost update only slows down the adaptation
+    if(hit){
+        rate += (SPIN_RATE_ONE - rate) / 8;
+        atomic_long_inc(&entry->spin_hits);
+    } else {
+        rate -= rate / 8;
+    }
+    WRITE_ONCE(entry->spin_rate, rate);
+}
+
+//spin up to budget_ns until ready(data)
+bool synchmess_spin(u64 budget_ns, bool (*ready)(void *data), void *data){
+    u64 start = ktime_get_ns();
+    
+    while(!ready(data)){
+        //as the optimistic spinning of mutexes, give up the cpu as soon as another task needs it
+        if(need_resched() || signal_pending(current) || ktime_get_ns() - start >= budget_ns){
+            return false;
+        }
+        cpu_relax();
+    }
+    return true;
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <linux/version.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+
+#include "synchmess-ioctl.h"
+
+//Core of the subsystem: queues, delayed messages and barriers of a group.
+//It does not know about files and user memory, so it can be used by the device files and by the KUnit tests.
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0)
+//wait_queue_t was renamed in 4.13
+typedef wait_queue_entry_t wait_queue_t;
+#endif
+
+//messages are charged to the memory cgroup of the sender
+#define SYNCHMESS_GFP (GFP_KERNEL | __GFP_ACCOUNT)
+
+//maximum number of bytes stored in a group, module parameter
+extern int synchmess_max_storage_size;
+//maximum spin budget (ns) of a group, module parameter
+extern unsigned long synchmess_max_spin_ns;
+
+//struct that contains a message
+struct message_t {
+    //body of the message
+    char *text;
+    //length of the body
+    size_t len;
+    //priority lane of the message
+    int priority;
+    //the message can be dropped under memory pressure
+    bool droppable;
+    //CLOCK_MONOTONIC time (ns) when the message was stored
+    u64 visible_ns;
+    //CLOCK_MONOTONIC time (ns) when the write was accepted
+    u64 enqueue_ns;
+    //sequence number in the group
+    u64 seq;
+    //process and thread that sent the message, in the initial pid namespace
+    pid_t tgid;
+    pid_t tid;
+    //queue the message belongs to
+    struct message_queue *queue;
+    //list of messages it belongs to
+    struct list_head list;
+    //list of all the messages of the group, in the order they were stored
+    struct list_head age_list;
+};
+
+//struct that contains a queue of messages, one FIFO list for each priority lane
+struct message_queue {
+    //lists of messages, one for each priority
+    struct list_head lanes[SYNCHMESS_PRIORITIES];
+    //bit i set means lane i is not empty
+    unsigned long lane_bitmap;
+};
+
+//header of a message stored in the ring of a group, followed by the body padded to 8 bytes
+struct ring_record {
+    //length of the body, RING_RECORD_WRAP marks the unused end of the ring
+    u32 len;
+    //process and thread that sent the message, in the initial pid namespace
+    pid_t tgid;
+    pid_t tid;
+    u32 reserved;
+    //sequence number in the group
+    u64 seq;
+    //CLOCK_MONOTONIC time (ns) when the write was accepted
+    u64 enqueue_ns;
+    //CLOCK_MONOTONIC time (ns) when the message was stored
+    u64 visible_ns;
+};
+
+#define RING_RECORD_WRAP U32_MAX
+//bytes of the ring used by a message of len bytes
+#define RING_RECORD_SIZE(len) (sizeof(struct ring_record) + ALIGN((len), 8))
+//the ring is this many times max_storage_size, rounded up to a power of two. With the header of each
+//record and the end skipped at a wrap, messages shorter than about 14 bytes can fill it before the quota.
+//The ring follows a larger max_storage_size the next time it is empty
+#define RING_SIZE_FACTOR 4
+
+//spin_rate of a group whose spins always end with a release
+#define SPIN_RATE_ONE 1024
+//below this spin_rate the waiters sleep at once, except one in SPIN_PROBE_INTERVAL
+#define SPIN_RATE_MIN (SPIN_RATE_ONE / 8)
+#define SPIN_PROBE_INTERVAL 16
+
+//copy of a message body into the ring from kernel memory, or of a message to a batch, which can be
+//in user memory. Returns 0 or an error
+typedef int (*ring_copy_t)(void *dst, const void *src, size_t len);
+//consumer of a message read from the ring, the message is removed only if it returns >= 0.
+//It runs without group_lock, so it can copy to the user
+typedef ssize_t (*ring_read_t)(void *data, const struct ring_record *record, const char *body);
+
+//struct that contains data for each delayed write
+struct delayed_work_params {
+    //CLOCK_MONOTONIC time (ns) when the message has to be stored
+    u64 deadline;
+    //message to be written, allocated by the sender
+    struct message_t *message;
+    //partition to write in, -1 for unkeyed messages
+    int partition;
+    //list of delayed_work_params it belongs to
+    struct list_head list;
+    //file that sent the message, NULL once the file is closed or for restored messages
+    struct synchgroup_session *owner;
+    //delayed messages of the owner, sorted by deadline
+    struct list_head owner_list;
+};
+
+//struct that contains info for each group
+struct group_dev {
+    //device number
+	dev_t devt;
+    //group name
+    char group_dev_name[32];
+    //list of groups
+    struct list_head list;
+    //queue of messages
+    struct message_queue message_list;
+    //queues of keyed messages, one for each partition
+    struct message_queue partition_list[SYNCHMESS_PARTITIONS];
+    //bytes of the messages stored in the group
+    size_t storage_bytes;
+    //number of messages stored in each priority lane
+    unsigned long lane_depth[SYNCHMESS_PRIORITIES];
+    //all the messages stored in the group, oldest first
+    struct list_head age_list;
+    //time to live of the messages (ns), 0 means no expiry
+    u64 ttl_ns;
+    //number of messages removed because older than ttl_ns
+    unsigned long expired;
+    //number of droppable messages, stored or delayed
+    unsigned long droppable;
+    //number of droppable messages removed under memory pressure
+    unsigned long reclaimed;
+    //sequence number of the next message accepted
+    u64 next_seq;
+    //read returns a message_header before each message
+    bool read_header;
+    //contiguous ring of ring_record storing the unkeyed messages, NULL when they are kept in message_list
+    char *ring;
+    //size of the ring, a power of 2
+    size_t ring_size;
+    //size of the last larger ring that could not be allocated, 0 if none
+    size_t ring_grow_failed;
+    //position of the first record and end of the last one, they only grow until the ring is empty
+    u64 ring_head;
+    u64 ring_tail;
+    //the first record is being copied by a reader without group_lock, it is not removed meanwhile
+    bool ring_reading;
+    //taken by the readers of the ring before group_lock, one reader copies a record at a time
+    struct mutex ring_read_lock;
+    //lock to access a group
+    struct mutex group_lock;
+    //timeout to manage write delay
+    u64 timeout_millis;
+    //workqueue to execute the delayed writes
+    struct workqueue_struct *wq;
+    //work that stores the delayed messages, armed for the earliest deadline
+    struct delayed_work delivery_work;
+    //list of delayed writes sorted by deadline, each one contains a message to be written
+    struct list_head delayed_work_param_list;
+    //number of delayed writes
+    unsigned long delayed;
+    //wait_queue to manage sleep on and awake barrier
+    wait_queue_head_t sleep_queue;
+    //incremented by each AWAKE_BARRIER
+    unsigned long barrier_generation;
+    //time (ns) a waiter spins before sleeping, 0 to sleep at once
+    u64 spin_ns;
+    //moving average of the spins that ended with a release, in 1/SPIN_RATE_ONE
+    unsigned int spin_rate;
+    //waits that did not spin because spin_rate was too low
+    atomic_long_t spin_skipped;
+    //waits that spun, and the ones released while spinning
+    atomic_long_t spin_attempts;
+    atomic_long_t spin_hits;
+    //wait_queue woken up when a message is stored
+    wait_queue_head_t read_queue;
+};
+
+//struct that contains info for each open file of a group, stored in private_data
+struct synchgroup_session {
+    //group the file belongs to
+    struct group_dev *group;
+    //partitions drained by read, 0 means the unkeyed messages
+    unsigned long partition_mask;
+    //last partition drained, to drain the partitions round robin
+    int last_partition;
+    //delayed messages sent through this file and not stored yet, sorted by deadline. Protected by group_lock
+    struct list_head delayed;
+};
+
+//free a message and its body
+static inline void message_free(struct message_t *message){
+    kfree(message->text);
+    kfree(message);
+}
+
+//deadline delay_ns after now, saturated instead of wrapping around to a deadline in the past
+static inline u64 synchmess_deadline_after(u64 now, u64 delay_ns){
+    return delay_ns > U64_MAX - now ? U64_MAX : now + delay_ns;
+}
+
+//deadline of a message sent at now with the delay of the group. A huge delay holds the message until a flush
+static inline u64 group_delay_deadline(struct group_dev *entry, u64 now){
+    u64 millis = READ_ONCE(entry->timeout_millis);
+    
+    if(millis > U64_MAX / NSEC_PER_MSEC){
+        return U64_MAX;
+    }
+    return synchmess_deadline_after(now, millis * NSEC_PER_MSEC);
+}
+
+//true if a message stored at visible_ns is older than the TTL of the group at now.
+//Written without visible_ns + ttl_ns, which overflows for a TTL meaning practically forever
+static inline bool group_message_expired(struct group_dev *entry, u64 visible_ns, u64 now){
+    return entry->ttl_ns != 0 && now >= visible_ns && now - visible_ns >= entry->ttl_ns;
+}
+
+//highest non-empty lane of the queue, -1 if the queue is empty
+static inline int message_queue_top(struct message_queue *queue){
+    return fls(queue->lane_bitmap) - 1;
+}
+
+//partition of a stored message, -1 for unkeyed messages
+static inline int message_partition(struct group_dev *entry, struct message_t *message){
+    if(message->queue == &entry->message_list){
+        return -1;
+    }
+    return message->queue - entry->partition_list;
+}
+
+//init a group with the given name, it is not added to any list of groups
+int synchgroup_init(struct group_dev *entry, const char *name, dev_t devt);
+//free all the messages of a group and stop its delayed writes
+void synchgroup_destroy(struct group_dev *entry);
+//init a reader of the unkeyed messages of a group
+void synchgroup_session_init(struct synchgroup_session *session, struct group_dev *entry);
+
+//allocate a message with a body of len bytes, to be filled by the caller
+struct message_t *synchmess_message_alloc(size_t len, int priority, bool droppable);
+//store a message in the group, or delay it until deadline. Partition -1 means unkeyed.
+//The message gets its sequence number and sender even if it is then dropped.
+//The group takes the ownership of the message, it is freed on error.
+//A delayed message is tracked as sent by owner too, NULL if it does not come from a file
+int synchgroup_send_message(struct group_dev *entry, struct message_t *message, int partition, u64 deadline, struct synchgroup_session *owner);
+//remove the next message of the session, NULL if there is nothing to read
+struct message_t *synchgroup_read_message(struct synchgroup_session *session);
+//as synchgroup_read_message, but a message longer than max_len is left in the queue and -EMSGSIZE is returned
+struct message_t *synchgroup_read_message_max(struct synchgroup_session *session, size_t max_len);
+//put back a message removed by synchgroup_read_message at the head of its lane
+void synchgroup_unread_message(struct group_dev *entry, struct message_t *message);
+//true if the session has a message to read. Called with group_lock held
+bool synchgroup_has_messages(struct synchgroup_session *session);
+//copy a message to the count bytes at buf of a batch with copy, in the format of RECEIVE_BATCH.
+//Only the first message of the batch is cut. Returns the bytes used, -EMSGSIZE if the message does not fit
+ssize_t synchmess_batch_copy_message(message_header *header, const char *text, void *buf, size_t count, bool first, ring_copy_t copy);
+
+//sleep until the next AWAKE_BARRIER on the group
+void synchgroup_barrier_sleep(struct group_dev *entry);
+//wake up all the threads sleeping on the barrier of the group
+void synchgroup_barrier_awake(struct group_dev *entry);
+
+//optional spin of the waiters before they sleep, as the optimistic spinning of mutexes
+//set the spin budget of the group, 0 to sleep at once. The caller checks it against max_spin_ns
+void synchgroup_set_spin_budget(struct group_dev *entry, u64 spin_ns);
+//true if a wait on the group has to spin before sleeping, then synchgroup_spin_end is called
+bool synchgroup_spin_begin(struct group_dev *entry);
+//account the end of a spin, hit if the wait ended while spinning
+void synchgroup_spin_end(struct group_dev *entry, bool hit);
+//spin up to budget_ns until ready(data), returns false if it was not ready in time or the cpu is needed
+bool synchmess_spin(u64 budget_ns, bool (*ready)(void *data), void *data);
+
+//Functions called with group_lock held
+//free the messages older than the TTL of the group, returns the bytes freed
+size_t synchgroup_expire_messages(struct group_dev *entry);
+//store (or revoke) the delayed messages with deadline in [from, to], returns the number of messages
+long synchgroup_flush_delayed(struct group_dev *entry, u64 from, u64 to, bool revoke);
+//store (or revoke) the delayed messages sent by session, returns the number of messages
+long synchgroup_flush_session_delayed(struct synchgroup_session *session, bool revoke);
+//the delayed messages sent by session are no longer tracked as its own, they stay delayed
+void synchgroup_detach_session(struct synchgroup_session *session);
+//arm the delivery work for the earliest deadline
+void synchgroup_arm_delivery(struct group_dev *entry);
+//store a restored message, keeping its visible_ns. Readers are not woken up
+int synchgroup_restore_message(struct group_dev *entry, struct message_t *message, int partition);
+//add a restored delayed message, the delivery work is not armed
+int synchgroup_restore_delayed(struct group_dev *entry, struct message_t *message, int partition, u64 deadline);
+//ring storage: strictly FIFO, no partitions and no priorities
+//store messages in a ring instead of message_list, or go back to message_list. The group must be empty.
+//Called with group_lock held
+int synchgroup_set_ring(struct group_dev *entry, bool enable);
+//record at *pos, then *pos is moved to the next one. NULL at the end of the ring. Called with group_lock held
+struct ring_record *synchgroup_ring_next(struct group_dev *entry, u64 *pos);
+//ring_copy_t for kernel memory
+int synchmess_ring_copy_kernel(void *dst, const void *src, size_t len);
+//store a message without delay in the ring of the group. Returns -ENOENT if the group has no ring
+int synchgroup_ring_send(struct group_dev *entry, const void *src, size_t len, ring_copy_t copy);
+//pass the first message of the ring to read, and remove it if read succeeds. Returns what read returns,
+//-ENODATA if the ring is empty and -ENOENT if the group has no ring
+ssize_t synchgroup_ring_read(struct group_dev *entry, ring_read_t read, void *data);
+
+//free up to nr droppable messages, returns the number of messages freed and adds their size to bytes
+unsigned long synchgroup_reclaim_messages(struct group_dev *entry, unsigned long nr, size_t *bytes);
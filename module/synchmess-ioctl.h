@@ -4,18 +4,277 @@
 
 #define MYDEV_IOC_MAGIC 'R'
 
+//number of partitions of a group, keyed messages are spread among them
+#define SYNCHMESS_PARTITION_BITS 4
+#define SYNCHMESS_PARTITIONS (1 << SYNCHMESS_PARTITION_BITS)
+
+//number of priority lanes of a group, the highest lane is read first
+#define SYNCHMESS_PRIORITIES 4
+
 typedef struct _group_t {
 	char name[11];
 } group_t;
 
+//The structs of the ioctls have the same layout for 32 and 64 bit processes, so the 64 bit module
+//serves both: pointers and sizes are carried in unsigned long long fields, which are aligned
+//to 8 bytes with explicit padding. Set a pointer field with (unsigned long long)(uintptr_t)ptr
+
 typedef struct _ioctl_info {
 	group_t group;
     char file_path[32];
-    unsigned long timeout_millis;
+    char reserved[5];
+    unsigned long long timeout_millis;
 } ioctl_info;
 
+//flags of send_info
+//time_ns is a delay relative to now
+#define SYNCHMESS_SEND_DELAY        0x1
+//time_ns is an absolute CLOCK_MONOTONIC deliver-at time
+#define SYNCHMESS_SEND_DELIVER_AT   0x2
+//the message can be dropped to reclaim memory under memory pressure
+#define SYNCHMESS_SEND_DROPPABLE    0x4
+
+//struct to send a message tagged with a partition key, priority and delay
+typedef struct _send_info {
+    //body of the message (pointer)
+    unsigned long long text;
+    //length of the body
+    unsigned long long len;
+    //messages with the same key are delivered in FIFO order
+    unsigned long long key;
+    //lane of the message, from 0 (lowest, used by write) to SYNCHMESS_PRIORITIES - 1
+    unsigned int priority;
+    //SYNCHMESS_SEND_* flags, without a delay flag the delay of the group is used
+    unsigned int flags;
+    //delay or deliver-at time in nanoseconds, depending on flags
+    unsigned long long time_ns;
+} send_info;
+
+//struct to select the delayed messages by deadline (CLOCK_MONOTONIC nanoseconds, bounds included)
+typedef struct _delay_range {
+    unsigned long long from_ns;
+    unsigned long long to_ns;
+} delay_range;
+
+//struct to select the partitions drained by read on a file
+typedef struct _partition_info {
+    //bit i set means partition i is drained, 0 means the unkeyed messages
+    unsigned long long partition_mask;
+} partition_info;
+
+//struct to get the statistics of a group
+typedef struct _group_stats {
+    //number of messages stored in each priority lane
+    unsigned long long lane_depth[SYNCHMESS_PRIORITIES];
+    //bytes of the messages stored in the group
+    unsigned long long storage_bytes;
+    //number of messages removed because older than the TTL of the group
+    unsigned long long expired;
+    //number of droppable messages removed under memory pressure
+    unsigned long long reclaimed;
+    //number of waits that spun before sleeping, and the ones released while spinning
+    unsigned long long spin_attempts;
+    unsigned long long spin_hits;
+} group_stats;
+
+//maximum number of groups of a WAIT_ANY call
+#define SYNCHMESS_WAIT_ANY_MAX 64
+
+//flags of wait_any_info
+//wait for a message on the unkeyed queue of the groups
+#define SYNCHMESS_WAIT_MESSAGE      0x1
+//wait for an AWAKE_BARRIER on the groups
+#define SYNCHMESS_WAIT_BARRIER      0x2
+//also read the first message of the first ready group
+#define SYNCHMESS_WAIT_DEQUEUE      0x4
+
+//struct to wait for a message or a barrier release on any of a set of groups
+typedef struct _wait_any_info {
+    //groups to wait on (pointer to an array of group_t)
+    unsigned long long groups;
+    //number of groups, at most SYNCHMESS_WAIT_ANY_MAX
+    unsigned int count;
+    //SYNCHMESS_WAIT_* flags
+    unsigned int flags;
+    //timeout in milliseconds, negative to wait forever. When the wait is interrupted by a signal it is
+    //updated to the time left, so a restarted call does not wait the whole timeout again
+    long long timeout_millis;
+    //out: bit i set means groups[i] is ready
+    unsigned long long ready;
+    //buffer for the message read with SYNCHMESS_WAIT_DEQUEUE (pointer)
+    unsigned long long buf;
+    //in: size of buf, out: bytes read
+    unsigned long long len;
+    //out: index of the group the message was read from, -1 if none
+    int index;
+    unsigned int reserved;
+} wait_any_info;
+
+//header returned by read before the body of each message, after SET_READ_HEADER(1) on the group.
+//Times are CLOCK_MONOTONIC nanoseconds: visible_ns - enqueue_ns is the delay of the message
+typedef struct _message_header {
+    //length of the body, read may return less of it
+    unsigned int len;
+    //process and thread that sent the message, in the pid namespace of the reader.
+    //0 if the sender is not visible there, as for a sender in a sibling container
+    int tgid;
+    int tid;
+    unsigned int reserved;
+    //sequence number of the message in its group, assigned when the write is accepted.
+    //Messages dropped because the storage was full leave a gap
+    unsigned long long seq;
+    //time the write was accepted
+    unsigned long long enqueue_ns;
+    //time the message was stored and became readable
+    unsigned long long visible_ns;
+} message_header;
+
+//struct to read several messages with RECEIVE_BATCH. Each message is copied as a message_header followed
+//by the body, the next message starts at the following multiple of 8 bytes. Only the first message is cut
+//if buf is too small for it, a following message that does not fit is left in the group
+typedef struct _batch_info {
+    //buffer of the messages (pointer)
+    unsigned long long buf;
+    //size of buf
+    unsigned long long len;
+    //maximum number of messages to read, 0 means as many as fit in buf
+    unsigned int max_messages;
+    //out: number of messages read
+    unsigned int messages;
+} batch_info;
+
+//commands of IORING_OP_URING_CMD on a group device, in sqe->cmd_op. They complete through the
+//completion queue instead of blocking the submitter, cqe->res is the result of the equivalent call.
+//They are available with Linux 6.7 or newer built with CONFIG_IO_URING
+//send_info at sqe->addr, as SEND_MESSAGE
+#define SYNCHMESS_URING_SEND            1
+//send_info at sqe->addr, as SEND_KEYED_MESSAGE
+#define SYNCHMESS_URING_SEND_KEYED      2
+//read into the sqe->len bytes at sqe->addr, completes when a message is read
+#define SYNCHMESS_URING_RECEIVE         3
+//batch_info at sqe->addr, as RECEIVE_BATCH, completes when at least one message is read
+#define SYNCHMESS_URING_RECEIVE_BATCH   4
+//completes at the next AWAKE_BARRIER, as SLEEP_ON_BARRIER
+#define SYNCHMESS_URING_BARRIER_WAIT    5
+
+//Snapshot of all the groups, written by DUMP_GROUPS and read by RESTORE_GROUPS.
+//The records are packed one after the other, with no padding:
+//  snapshot_header
+//  for each group: snapshot_group, then snapshot_group.messages stored messages (oldest first)
+//  and snapshot_group.delayed delayed messages (earliest deadline first)
+//  for each message: snapshot_message, then snapshot_message.len bytes of body
+//Times are CLOCK_MONOTONIC, so a snapshot can be restored until the next reboot.
+//Version 2 adds the fields of the read header and version 3 the spin budget of the groups,
+//snapshots of older versions can still be restored.
+#define SYNCHMESS_SNAPSHOT_MAGIC    0x53594e43
+#define SYNCHMESS_SNAPSHOT_VERSION  3
+//size of the records of version 1, they end before the fields added by version 2
+#define SYNCHMESS_SNAPSHOT_V1_GROUP_SIZE    40
+#define SYNCHMESS_SNAPSHOT_V1_MESSAGE_SIZE  16
+//size of the group records of version 2, the message records did not change
+#define SYNCHMESS_SNAPSHOT_V2_GROUP_SIZE    56
+
+//flags of snapshot_group
+//read returns a message_header before each message
+#define SYNCHMESS_SNAPSHOT_READ_HEADER  0x1
+//the messages are stored in a ring, as after SET_STORAGE_RING(1)
+#define SYNCHMESS_SNAPSHOT_RING         0x2
+
+typedef struct _snapshot_header {
+    //SYNCHMESS_SNAPSHOT_MAGIC
+    unsigned int magic;
+    //SYNCHMESS_SNAPSHOT_VERSION
+    unsigned int version;
+    //number of group records
+    unsigned int groups;
+    unsigned int reserved;
+} snapshot_header;
+
+typedef struct _snapshot_group {
+    group_t group;
+    char reserved[5];
+    //delay of the group, as SET_SEND_DELAY
+    unsigned long long timeout_millis;
+    //TTL of the messages (ns), 0 means no expiry
+    unsigned long long ttl_ns;
+    //number of stored messages
+    unsigned int messages;
+    //number of delayed messages
+    unsigned int delayed;
+    //since version 2: sequence number of the next message sent to the group
+    unsigned long long next_seq;
+    //since version 2: SYNCHMESS_SNAPSHOT_* flags
+    unsigned int flags;
+    unsigned int reserved2;
+    //since version 3: spin budget (ns) of the group, as SET_SPIN_BUDGET
+    unsigned long long spin_ns;
+} snapshot_group;
+
+typedef struct _snapshot_message {
+    //time the message was stored, or deadline of a delayed message
+    unsigned long long time_ns;
+    //length of the body
+    unsigned int len;
+    //partition of a keyed message, -1 for unkeyed messages
+    short partition;
+    //priority lane
+    unsigned char priority;
+    //SYNCHMESS_SEND_DROPPABLE or 0
+    unsigned char flags;
+    //since version 2: the fields of message_header, tgid and tid in the initial pid namespace
+    unsigned long long seq;
+    unsigned long long enqueue_ns;
+    int tgid;
+    int tid;
+} snapshot_message;
+
+//struct to dump or restore a snapshot
+typedef struct _snapshot_info {
+    //buffer of the snapshot (pointer)
+    unsigned long long buf;
+    //in: size of buf. out: size of the snapshot, on ENOSPC the size buf must have
+    unsigned long long len;
+    //out: number of groups dumped or restored
+    unsigned long long groups;
+    //out: number of messages, stored and delayed, dumped or restored
+    unsigned long long messages;
+    //out: number of messages not restored because the storage of their group was full
+    unsigned long long dropped;
+} snapshot_info;
+
+//partition a key is mapped to, the same hash is used by the module and by the clients
+static inline unsigned int synchmess_key_partition(unsigned long long key){
+    return (unsigned int)((key * 0x61C8864680B583EBULL) >> (64 - SYNCHMESS_PARTITION_BITS));
+}
+
 #define IOCTL_INSTALL_GROUP	 		_IOW(MYDEV_IOC_MAGIC, 1, ioctl_info *)
 #define SET_SEND_DELAY              _IOW(MYDEV_IOC_MAGIC, 2, ioctl_info *)
 #define REVOKE_DELAYED_MESSAGES     _IO(MYDEV_IOC_MAGIC, 3)
 #define SLEEP_ON_BARRIER            _IO(MYDEV_IOC_MAGIC, 4)
 #define AWAKE_BARRIER               _IO(MYDEV_IOC_MAGIC, 5)
+#define SEND_KEYED_MESSAGE          _IOW(MYDEV_IOC_MAGIC, 6, send_info *)
+#define SET_READ_PARTITIONS         _IOW(MYDEV_IOC_MAGIC, 7, partition_info *)
+#define SEND_MESSAGE                _IOW(MYDEV_IOC_MAGIC, 8, send_info *)
+#define GET_GROUP_STATS             _IOR(MYDEV_IOC_MAGIC, 9, group_stats *)
+#define FLUSH_DELAYED_RANGE         _IOW(MYDEV_IOC_MAGIC, 10, delay_range *)
+#define REVOKE_DELAYED_RANGE        _IOW(MYDEV_IOC_MAGIC, 11, delay_range *)
+#define SET_MESSAGE_TTL             _IOW(MYDEV_IOC_MAGIC, 12, ioctl_info *)
+#define WAIT_ANY                    _IOWR(MYDEV_IOC_MAGIC, 13, wait_any_info *)
+//DUMP_GROUPS and RESTORE_GROUPS need CAP_SYS_ADMIN
+#define DUMP_GROUPS                 _IOWR(MYDEV_IOC_MAGIC, 14, snapshot_info *)
+#define RESTORE_GROUPS              _IOWR(MYDEV_IOC_MAGIC, 15, snapshot_info *)
+//the argument is 1 to enable the message_header of read, 0 to disable it
+#define SET_READ_HEADER             _IO(MYDEV_IOC_MAGIC, 16)
+//the argument is 1 to store the messages of an empty group in a contiguous ring sized from max_storage_size,
+//0 to go back to the queues. A group with a ring is strictly FIFO: keyed and priority sends fail with EINVAL
+#define SET_STORAGE_RING            _IO(MYDEV_IOC_MAGIC, 17)
+//returns the bytes used in the buffer, 0 if the group is empty
+#define RECEIVE_BATCH               _IOWR(MYDEV_IOC_MAGIC, 18, batch_info *)
+//the argument is the time (ns) SLEEP_ON_BARRIER and WAIT_ANY spin before sleeping, 0 to sleep at once.
+//The spin stops as soon as the cpu is needed, and is skipped while the spins of the group rarely end with a release.
+//A budget above the max_spin_ns module parameter fails with EINVAL
+#define SET_SPIN_BUDGET             _IO(MYDEV_IOC_MAGIC, 19)
+//revoke or store the delayed messages sent through the file, returns the number of messages.
+//close stores them too, REVOKE_DELAYED_MESSAGES and FLUSH_DELAYED_RANGE act on the whole group
+#define REVOKE_OWN_DELAYED          _IO(MYDEV_IOC_MAGIC, 20)
+#define FLUSH_OWN_DELAYED           _IO(MYDEV_IOC_MAGIC, 21)
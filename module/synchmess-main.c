@@ -0,0 +1,1636 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h> 
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/version.h>
+#include <linux/uaccess.h>
+#include <asm-generic/errno-base.h>
+#include <asm/uaccess.h>
+#include <asm/segment.h>
+#include <linux/buffer_head.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/delay.h>
+#include <linux/sched.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+//signal_pending moved out of sched.h in 4.11
+#include <linux/sched/signal.h>
+#endif
+#include <linux/ktime.h>
+#include <linux/poll.h>
+#include <linux/shrinker.h>
+#include <linux/refcount.h>
+#include <linux/capability.h>
+#include <linux/pid_namespace.h>
+
+#include "synchmess-core.h"
+#include "synchmess-snapshot.h"
+
+MODULE_AUTHOR("Daniele Pasquini <pasqdaniele@gmail.com>");
+MODULE_DESCRIPTION("Thread Synchronization and Messaging Subsystem");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+//class_create lost the owner argument in 6.4
+#define synchmess_class_create(name) class_create(name)
+#else
+#define synchmess_class_create(name) class_create(THIS_MODULE, name)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+//the structs of the ioctls have the same layout for 32 bit processes, only the argument is converted with compat_ptr
+#define synchmess_compat_ioctl compat_ptr_ioctl
+#define synchgroup_compat_ioctl compat_ptr_ioctl
+#else
+#define synchmess_compat_ioctl synchmess_ioctl
+#define synchgroup_compat_ioctl synchgroup_ioctl
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0) && defined(CONFIG_IO_URING)
+//uring_cmd can be canceled since 6.7, so commands waiting on a group do not block the exit of the ring
+#define SYNCHMESS_URING_CMD
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0)
+//the declarations of uring_cmd moved to their own header in 6.8
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,18,0)
+//since 6.18 io_uring_cmd_done has no second result, io_uring_cmd_done32 takes it
+#define synchmess_uring_cmd_done(cmd, ret, issue_flags) io_uring_cmd_done(cmd, ret, issue_flags)
+#else
+#define synchmess_uring_cmd_done(cmd, ret, issue_flags) io_uring_cmd_done(cmd, ret, 0, issue_flags)
+#endif
+#endif
+
+static int max_message_size = 50;
+module_param(max_message_size,int,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH);
+MODULE_PARM_DESC(max_message_size,"The maximum size (bytes) currently allowed for posting messages to the device file");
+
+static int sweep_interval_millis = 1000;
+module_param(sweep_interval_millis,int,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH);
+MODULE_PARM_DESC(sweep_interval_millis,"The interval (milliseconds) between two scans removing the messages older than the TTL of their group, at least 10");
+//shortest interval between two sweeps, each one takes group_list_lock and the lock of every group with a TTL
+#define SWEEP_INTERVAL_MIN_MILLIS 10
+
+static unsigned long reclaimed_bytes = 0;
+module_param(reclaimed_bytes,ulong,S_IRUSR|S_IRGRP|S_IROTH);
+MODULE_PARM_DESC(reclaimed_bytes,"The number of bytes of messages removed under memory pressure");
+
+//list of groups
+static struct list_head group_list;
+//lock to access the list of groups
+static DEFINE_MUTEX(group_list_lock);
+
+//work that periodically removes the expired messages of all the groups
+static struct delayed_work sweep_work;
+
+long synchmess_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+int synchmess_open(struct inode *inode, struct file *filp);
+int synchmess_release(struct inode *inode, struct file *filp);
+
+long synchgroup_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+int synchgroup_open(struct inode *inode, struct file *filp);
+int synchgroup_release(struct inode *inode, struct file *filp);
+ssize_t synchgroup_read (struct file *file, char __user *buf, size_t count, loff_t *offset);
+ssize_t synchgroup_write (struct file *file, const char __user *buf, size_t count, loff_t *offset);
+int synchgroup_flush (struct file *file, fl_owner_t id);
+unsigned int synchgroup_poll (struct file *file, poll_table *wait);
+#ifdef SYNCHMESS_URING_CMD
+int synchgroup_uring_cmd(struct io_uring_cmd *cmd, unsigned int issue_flags);
+#endif
+
+//File operations for the device synchmess
+//synchmess is the device that allows a client to create a group
+struct file_operations synchmess_fops = {
+	open: synchmess_open,
+	unlocked_ioctl: synchmess_ioctl,
+	compat_ioctl: synchmess_compat_ioctl,
+	release: synchmess_release
+};
+
+// File operations for the device synchgroup
+struct file_operations synchgroup_fops = {
+	open: synchgroup_open,
+	unlocked_ioctl: synchgroup_ioctl,
+	compat_ioctl: synchgroup_compat_ioctl,
+	release: synchgroup_release,
+    read: synchgroup_read,
+    write: synchgroup_write,
+    flush: synchgroup_flush,
+#ifdef SYNCHMESS_URING_CMD
+    uring_cmd: synchgroup_uring_cmd,
+#endif
+    poll: synchgroup_poll
+};
+
+//counter that keeps the last group minor
+static atomic_t groups_number;
+
+// Variables to correctly setup/shutdown the pseudo device file for synchgroup
+static int synchgroup_major;
+static struct class *synchgroup_dev_cl = NULL;
+
+//Search the group with the given device number in the list of group_dev
+static struct group_dev *find_group_dev(dev_t devt){
+    struct list_head *ptr;
+    struct group_dev *entry;
+
+    mutex_lock(&group_list_lock);
+    list_for_each(ptr,&group_list){
+        entry=list_entry(ptr,struct group_dev, list);
+        if(entry->devt == devt){
+            mutex_unlock(&group_list_lock);
+            return entry;
+        }
+    }
+    mutex_unlock(&group_list_lock);
+    return NULL;
+}
+
+//to make the messages with delay sent through this file immediately available to subsequent read calls.
+//It runs on every close, so the delayed messages of the other files are left alone
+int synchgroup_flush (struct file *file, fl_owner_t id){
+    struct synchgroup_session *session = file->private_data;
+    struct group_dev *entry = session->group;
+    
+    printk(KERN_INFO "%s: flush operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(file->f_path.dentry->d_inode->i_rdev));
+    
+    //to enable concurrent access
+    mutex_lock(&entry->group_lock);
+    
+    //store the delayed messages of the file, in deadline order
+    if(synchgroup_flush_session_delayed(session, false)){
+        synchgroup_arm_delivery(entry);
+    }
+    
+    mutex_unlock(&entry->group_lock);
+    return 0;
+}
+
+//deadline of a message sent through send_info, by default the delay of the group
+static u64 send_info_deadline(struct group_dev *entry, send_info *message_info){
+    u64 now = ktime_get_ns();
+    
+    if(message_info->flags & SYNCHMESS_SEND_DELIVER_AT){
+        return message_info->time_ns;
+    }
+    if(message_info->flags & SYNCHMESS_SEND_DELAY){
+        return synchmess_deadline_after(now, message_info->time_ns);
+    }
+    return group_delay_deadline(entry, now);
+}
+
+//messages up to this size are copied from the user to the stack before a ring send
+#define RING_BOUNCE_STACK 128
+
+//store a message without delay in the ring of the group. The message is copied from the user
+//before group_lock is taken, so a fault on the user buffer does not block the group.
+//Returns -ENOENT if the group has no ring
+static int synchgroup_ring_send_user(struct group_dev *entry, const char __user *buf, size_t len){
+    char stack_buf[RING_BOUNCE_STACK];
+    char *bounce = stack_buf;
+    int err;
+    
+    if(len > sizeof(stack_buf)){
+        bounce = kmalloc(len, GFP_KERNEL);
+        if(bounce == NULL){
+            return -ENOMEM;
+        }
+    }
+    if(copy_from_user(bounce, buf, len)){
+        err = -EFAULT;
+    }else{
+        err = synchgroup_ring_send(entry, bounce, len, synchmess_ring_copy_kernel);
+    }
+    if(bounce != stack_buf){
+        kfree(bounce);
+    }
+    return err;
+}
+
+//store a message in the group, or delay it until deadline. Partition -1 means unkeyed
+static ssize_t synchgroup_send(struct synchgroup_session *session, const char __user *buf, size_t count, int partition, int priority, bool droppable, u64 deadline){
+    struct group_dev *entry = session->group;
+    size_t maxdatalen = max_message_size; 
+    struct message_t *message;
+    int err;
+    
+    //count is the number of bytes the client wants to write
+    if (count < maxdatalen) {
+        maxdatalen = count;
+    }
+    
+    if(READ_ONCE(entry->ring) != NULL){
+        //a group with a ring is strictly FIFO
+        if(partition >= 0 || priority > 0){
+            return -EINVAL;
+        }
+        //without delay the message is stored in the ring, without allocating a message_t
+        if(deadline <= ktime_get_ns()){
+            err = synchgroup_ring_send_user(entry, buf, maxdatalen);
+            if(err != -ENOENT){
+                return err ? err : maxdatalen;
+            }
+        }
+    }
+    
+    //the message is allocated here even when delayed, so it is charged to the sender
+    message = synchmess_message_alloc(maxdatalen, priority, droppable);
+    if(message == NULL){
+        return -ENOMEM;
+    }
+    if(copy_from_user(message->text, buf, maxdatalen)){
+        printk(KERN_INFO "%s: Could't copy %zd bytes from the user\n", KBUILD_MODNAME, maxdatalen);
+        message_free(message);
+        return -EFAULT;
+    }
+    printk(KERN_INFO "%s: Copied %zd bytes from the user\n", KBUILD_MODNAME, maxdatalen);
+    
+    //a delayed message is tracked as sent by this file, for the flush on close
+    err = synchgroup_send_message(entry, message, partition, deadline, session);
+    if(err){
+        return err;
+    }
+    return maxdatalen;
+}
+
+//send the message of a send_info of the user, keyed as SEND_KEYED_MESSAGE or unkeyed as SEND_MESSAGE
+static ssize_t synchgroup_send_info(struct synchgroup_session *session, const send_info __user *arg, bool keyed){
+    send_info message_info;
+    
+    if(copy_from_user(&message_info, arg, sizeof(send_info))){
+        return -EFAULT;
+    }
+    if(message_info.priority >= SYNCHMESS_PRIORITIES){
+        return -EINVAL;
+    }
+    //the key selects the partition, so messages with the same key keep FIFO order
+    return synchgroup_send(session, u64_to_user_ptr(message_info.text), min_t(u64, message_info.len, SIZE_MAX), keyed ? synchmess_key_partition(message_info.key) : -1, message_info.priority, message_info.flags & SYNCHMESS_SEND_DROPPABLE, send_info_deadline(session->group, &message_info));
+}
+
+static ssize_t session_read_batch_to_user(struct synchgroup_session *session, char __user *buf, size_t count, unsigned int max_messages, unsigned int *messages);
+
+//file operation to manage operations on groups(SET_SEND_DELAY, REVOKE_DELAYED_MESSAGES, SLEEP_ON_BARRIER, AWAKE_BARRIER, SEND_KEYED_MESSAGE, SET_READ_PARTITIONS, SEND_MESSAGE, GET_GROUP_STATS, SET_MESSAGE_TTL, FLUSH_DELAYED_RANGE, REVOKE_DELAYED_RANGE, SET_READ_HEADER, SET_STORAGE_RING, RECEIVE_BATCH, SET_SPIN_BUDGET, REVOKE_OWN_DELAYED, FLUSH_OWN_DELAYED)
+long synchgroup_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
+	long ret = 0;
+    //struct to exchange data with the client
+    ioctl_info info;
+    partition_info partitions;
+    batch_info batch;
+    delay_range range;
+    group_stats stats;
+    int i;
+    struct synchgroup_session *session = filp->private_data;
+    struct group_dev *entry = session->group;
+
+	switch (cmd) {
+        case SET_SEND_DELAY:
+            printk(KERN_INFO "%s: SET SEND DELAY operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            if(copy_from_user(&info, (ioctl_info *)arg, sizeof(ioctl_info))){
+                ret = -EFAULT;
+                goto out_ioctl;
+            }
+            entry->timeout_millis = info.timeout_millis;
+			goto out_ioctl;
+            
+        case REVOKE_DELAYED_MESSAGES:
+            printk(KERN_INFO "%s: REVOKE DELAYED MESSAGES operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            //to enable concurrent access
+            mutex_lock(&entry->group_lock);
+            
+            //remove all the delayed messages of the group
+            synchgroup_flush_delayed(entry, 0, U64_MAX, true);
+            synchgroup_arm_delivery(entry);
+            
+            mutex_unlock(&entry->group_lock);
+			goto out_ioctl;
+            
+        case REVOKE_OWN_DELAYED:
+        case FLUSH_OWN_DELAYED:
+            printk(KERN_INFO "%s: %s OWN DELAYED operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, cmd == FLUSH_OWN_DELAYED ? "FLUSH" : "REVOKE", MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            mutex_lock(&entry->group_lock);
+            //only the delayed messages of the file are scanned, the number of messages flushed or revoked is returned
+            ret = synchgroup_flush_session_delayed(session, cmd == REVOKE_OWN_DELAYED);
+            if(ret){
+                synchgroup_arm_delivery(entry);
+            }
+            mutex_unlock(&entry->group_lock);
+			goto out_ioctl;
+            
+        case SLEEP_ON_BARRIER:
+            printk(KERN_INFO "%s: SLEEP ON BARRIER operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            synchgroup_barrier_sleep(entry);
+			goto out_ioctl;
+            
+        case AWAKE_BARRIER:
+            printk(KERN_INFO "%s: AWAKE BARRIER operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            synchgroup_barrier_awake(entry);
+			goto out_ioctl;
+            
+        case SEND_KEYED_MESSAGE:
+            printk(KERN_INFO "%s: SEND KEYED MESSAGE operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            ret = synchgroup_send_info(session, (send_info *)arg, true);
+			goto out_ioctl;
+            
+        case SEND_MESSAGE:
+            printk(KERN_INFO "%s: SEND MESSAGE operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            //same as write, but in the priority lane selected by the client
+            ret = synchgroup_send_info(session, (send_info *)arg, false);
+			goto out_ioctl;
+            
+        case GET_GROUP_STATS:
+            memset(&stats, 0, sizeof(stats));
+            mutex_lock(&entry->group_lock);
+            for(i = 0; i < SYNCHMESS_PRIORITIES; i++){
+                stats.lane_depth[i] = entry->lane_depth[i];
+            }
+            stats.storage_bytes = entry->storage_bytes;
+            stats.expired = entry->expired;
+            stats.reclaimed = entry->reclaimed;
+            stats.spin_attempts = atomic_long_read(&entry->spin_attempts);
+            stats.spin_hits = atomic_long_read(&entry->spin_hits);
+            mutex_unlock(&entry->group_lock);
+            if(copy_to_user((group_stats *)arg, &stats, sizeof(group_stats))){
+                ret = -EFAULT;
+            }
+			goto out_ioctl;
+            
+        case SET_MESSAGE_TTL:
+            printk(KERN_INFO "%s: SET MESSAGE TTL operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            if(copy_from_user(&info, (ioctl_info *)arg, sizeof(ioctl_info))){
+                ret = -EFAULT;
+                goto out_ioctl;
+            }
+            mutex_lock(&entry->group_lock);
+            //timeout_millis is the TTL, 0 disables the expiry
+            //saturate instead of wrapping around, so a huge TTL means no expiry in practice
+            if(info.timeout_millis > U64_MAX / NSEC_PER_MSEC){
+                entry->ttl_ns = U64_MAX;
+            } else {
+                entry->ttl_ns = (u64)info.timeout_millis * NSEC_PER_MSEC;
+            }
+            synchgroup_expire_messages(entry);
+            mutex_unlock(&entry->group_lock);
+			goto out_ioctl;
+            
+        case FLUSH_DELAYED_RANGE:
+        case REVOKE_DELAYED_RANGE:
+            printk(KERN_INFO "%s: %s DELAYED RANGE operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, cmd == FLUSH_DELAYED_RANGE ? "FLUSH" : "REVOKE", MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            if(copy_from_user(&range, (delay_range *)arg, sizeof(delay_range))){
+                ret = -EFAULT;
+                goto out_ioctl;
+            }
+            mutex_lock(&entry->group_lock);
+            //the number of messages flushed or revoked is returned
+            ret = synchgroup_flush_delayed(entry, range.from_ns, range.to_ns, cmd == REVOKE_DELAYED_RANGE);
+            synchgroup_arm_delivery(entry);
+            mutex_unlock(&entry->group_lock);
+			goto out_ioctl;
+            
+        case SET_READ_HEADER:
+            printk(KERN_INFO "%s: SET READ HEADER operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            //read checks it without group_lock
+            WRITE_ONCE(entry->read_header, arg != 0);
+			goto out_ioctl;
+            
+        case SET_STORAGE_RING:
+            printk(KERN_INFO "%s: SET STORAGE RING operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            mutex_lock(&entry->group_lock);
+            ret = synchgroup_set_ring(entry, arg != 0);
+            mutex_unlock(&entry->group_lock);
+			goto out_ioctl;
+            
+        case SET_SPIN_BUDGET:
+            printk(KERN_INFO "%s: SET SPIN BUDGET operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            //a longer spin would keep a cpu busy for nothing
+            if(arg > READ_ONCE(synchmess_max_spin_ns)){
+                ret = -EINVAL;
+                goto out_ioctl;
+            }
+            synchgroup_set_spin_budget(entry, arg);
+			goto out_ioctl;
+            
+        case RECEIVE_BATCH:
+            printk(KERN_INFO "%s: RECEIVE BATCH operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            if(copy_from_user(&batch, (batch_info *)arg, sizeof(batch_info))){
+                ret = -EFAULT;
+                goto out_ioctl;
+            }
+            //as read, nothing to read is not an error
+            ret = session_read_batch_to_user(session, u64_to_user_ptr(batch.buf), min_t(u64, batch.len, SIZE_MAX), batch.max_messages, &batch.messages);
+            if(ret == -ENODATA){
+                ret = 0;
+            }
+            if(ret >= 0 && copy_to_user((batch_info *)arg, &batch, sizeof(batch_info))){
+                ret = -EFAULT;
+            }
+			goto out_ioctl;
+            
+        case SET_READ_PARTITIONS:
+            printk(KERN_INFO "%s: SET READ PARTITIONS operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+            if(copy_from_user(&partitions, (partition_info *)arg, sizeof(partition_info))){
+                ret = -EFAULT;
+                goto out_ioctl;
+            }
+            if(partitions.partition_mask >> SYNCHMESS_PARTITIONS){
+                ret = -EINVAL;
+                goto out_ioctl;
+            }
+            //the session is shared by the threads using the same file
+            mutex_lock(&entry->group_lock);
+            session->partition_mask = partitions.partition_mask;
+            session->last_partition = SYNCHMESS_PARTITIONS - 1;
+            mutex_unlock(&entry->group_lock);
+			goto out_ioctl;
+	}
+
+    out_ioctl:
+	return ret;
+}
+
+int synchgroup_open(struct inode *inode, struct file *filp) {
+    struct synchgroup_session *session;
+    struct group_dev *entry;
+    
+    printk(KERN_INFO "%s: Open operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+    
+    entry = find_group_dev(inode->i_rdev);
+    if(entry == NULL){
+        return -ENODEV;
+    }
+    
+    //the session keeps the group and the partitions drained by this file
+    session = kmalloc(sizeof(*session),GFP_KERNEL);
+    if(session == NULL){
+        return -ENOMEM;
+    }
+    synchgroup_session_init(session, entry);
+    filp->private_data = session;
+	return 0;
+}
+
+
+int synchgroup_release(struct inode *inode, struct file *filp){
+    struct synchgroup_session *session = filp->private_data;
+    
+    printk(KERN_INFO "%s: Release operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(filp->f_path.dentry->d_inode->i_rdev));
+    //messages delayed after the last flush of the file, by a thread still using it, are delivered at their deadline
+    mutex_lock(&session->group->group_lock);
+    synchgroup_detach_session(session);
+    mutex_unlock(&session->group->group_lock);
+    kfree(session);
+	return 0;
+}
+
+//readable when read would return a message
+unsigned int synchgroup_poll (struct file *file, poll_table *wait){
+    struct synchgroup_session *session = file->private_data;
+    struct group_dev *entry = session->group;
+    unsigned int mask = 0;
+    
+    poll_wait(file, &entry->read_queue, wait);
+    
+    mutex_lock(&entry->group_lock);
+    synchgroup_expire_messages(entry);
+    if(synchgroup_has_messages(session)){
+        mask |= POLLIN | POLLRDNORM;
+    }
+    mutex_unlock(&entry->group_lock);
+    return mask;
+}
+
+//copy a message to the user, after its header if the group has read_header set.
+//Returns the bytes copied
+static ssize_t message_copy_to_user(struct group_dev *entry, message_header *header, const char *text, char __user *buf, size_t count){
+    size_t header_len = 0;
+    
+    if(READ_ONCE(entry->read_header)){
+        //the header is never cut
+        if(count < sizeof(*header)){
+            return -EINVAL;
+        }
+        if(copy_to_user(buf, header, sizeof(*header))){
+            return -EFAULT;
+        }
+        header_len = sizeof(*header);
+        count -= header_len;
+    }
+    
+    //count is the max number of bytes the client wants to read
+    if (count > header->len) {
+        //if count is bigger than the length of the message it will be cut
+        count = header->len;
+    }
+    if (copy_to_user(buf + header_len, text, count)) {
+        return -EFAULT;
+    }
+    return header_len + count;
+}
+
+//ring_copy_t copying a message to a batch of the user
+static int batch_copy_to_user(void *dst, const void *src, size_t len){
+    return copy_to_user((char __user *)dst, src, len) ? -EFAULT : 0;
+}
+
+//id of a sender, stored in the initial pid namespace, as seen by the reading task. 0 if the sender
+//is not visible in the pid namespace of the reader, or if it has exited and the reader is in a child namespace
+static pid_t sender_vnr(pid_t nr){
+    struct pid *pid;
+    pid_t vnr = 0;
+    
+    if(nr == 0 || task_active_pid_ns(current) == &init_pid_ns){
+        return nr;
+    }
+    rcu_read_lock();
+    pid = find_pid_ns(nr, &init_pid_ns);
+    if(pid != NULL){
+        vnr = pid_vnr(pid);
+    }
+    rcu_read_unlock();
+    return vnr;
+}
+
+//user buffer of a read from a group
+struct ring_read_buf {
+    struct group_dev *entry;
+    char __user *buf;
+    size_t count;
+    //the message is copied as a record of a batch, first for the first record
+    bool batch;
+    bool first;
+};
+
+//copy a message to the buffer of a read
+static ssize_t read_buf_copy(struct ring_read_buf *read_buf, message_header *header, const char *text){
+    if(read_buf->batch){
+        return synchmess_batch_copy_message(header, text, (void __force *)read_buf->buf, read_buf->count, read_buf->first, batch_copy_to_user);
+    }
+    return message_copy_to_user(read_buf->entry, header, text, read_buf->buf, read_buf->count);
+}
+
+//ring_read_t copying the message to the user
+static ssize_t ring_copy_to_user(void *data, const struct ring_record *record, const char *body){
+    struct ring_read_buf *read_buf = data;
+    message_header header;
+    
+    header.len = record->len;
+    header.tgid = sender_vnr(record->tgid);
+    header.tid = sender_vnr(record->tid);
+    header.reserved = 0;
+    header.seq = record->seq;
+    header.enqueue_ns = record->enqueue_ns;
+    header.visible_ns = record->visible_ns;
+    return read_buf_copy(read_buf, &header, body);
+}
+
+//read the next message of the session to the buffer. Returns the bytes copied, -ENODATA if there is nothing to read
+static ssize_t session_read_buf(struct synchgroup_session *session, struct ring_read_buf *read_buf){
+    struct group_dev *entry = session->group;
+    struct message_t *message;
+    message_header header;
+    size_t max_len = SIZE_MAX;
+    ssize_t ret;
+    
+    if(session->partition_mask == 0 && READ_ONCE(entry->ring) != NULL){
+        //the message is copied from the ring, and removed only once it is copied
+        ret = synchgroup_ring_read(entry, ring_copy_to_user, read_buf);
+        if(ret != -ENOENT){
+            return ret;
+        }
+    }
+    
+    //a message that does not fit in the rest of a batch keeps its place in the queue
+    if(read_buf->batch && !read_buf->first){
+        if(read_buf->count < sizeof(header)){
+            return -EMSGSIZE;
+        }
+        max_len = read_buf->count - sizeof(header);
+    }
+    //get the first message of the highest lane and remove it from the queue
+    message = synchgroup_read_message_max(session, max_len);
+    if(IS_ERR(message)){
+        return PTR_ERR(message);
+    }
+    if(message == NULL){
+        return -ENODATA;
+    }
+    
+    header.len = message->len;
+    header.tgid = sender_vnr(message->tgid);
+    header.tid = sender_vnr(message->tid);
+    header.reserved = 0;
+    header.seq = message->seq;
+    header.enqueue_ns = message->enqueue_ns;
+    header.visible_ns = message->visible_ns;
+    //copy message to the user out of the lock, so readers of other partitions are not blocked
+    ret = read_buf_copy(read_buf, &header, message->text);
+    if (ret < 0) {
+        //the copy failed, put the message back at the head of its lane
+        synchgroup_unread_message(entry, message);
+        return ret;
+    }
+    
+    message_free(message);
+    return ret;
+}
+
+//read the next message of the session to the user. Returns the bytes copied, -ENODATA if there is nothing to read
+static ssize_t session_read_to_user(struct synchgroup_session *session, char __user *buf, size_t count){
+    struct ring_read_buf read_buf = {
+        .entry = session->group,
+        .buf = buf,
+        .count = count,
+    };
+    
+    //a buffer without room for the header would lose the message
+    if(READ_ONCE(session->group->read_header) && count < sizeof(message_header)){
+        return -EINVAL;
+    }
+    return session_read_buf(session, &read_buf);
+}
+
+//read up to max_messages messages of the session to the user, 0 means as many as fit.
+//Returns the bytes used, -ENODATA if there is nothing to read
+static ssize_t session_read_batch_to_user(struct synchgroup_session *session, char __user *buf, size_t count, unsigned int max_messages, unsigned int *messages){
+    struct ring_read_buf read_buf;
+    size_t offset = 0;
+    ssize_t ret;
+    
+    *messages = 0;
+    while(offset < count && (max_messages == 0 || *messages < max_messages)){
+        read_buf.entry = session->group;
+        read_buf.buf = buf + offset;
+        read_buf.count = count - offset;
+        read_buf.batch = true;
+        read_buf.first = *messages == 0;
+        ret = session_read_buf(session, &read_buf);
+        if(ret < 0){
+            //the messages already copied are returned
+            if(*messages == 0){
+                return ret;
+            }
+            break;
+        }
+        offset += ret;
+        (*messages)++;
+    }
+    return offset;
+}
+
+ssize_t synchgroup_read (struct file *file, char __user *buf, size_t count, loff_t *offset){
+    struct synchgroup_session *session = file->private_data;
+    ssize_t ret;
+    
+    printk(KERN_INFO "%s: read operation, synchgroup device minor: %d.\n", KBUILD_MODNAME, MINOR(file->f_path.dentry->d_inode->i_rdev));
+    
+    ret = session_read_to_user(session, buf, count);
+    if(ret == -ENODATA){
+        //if the list is empty there are no messages to read
+        printk(KERN_INFO "%s: List is empty\n", KBUILD_MODNAME);
+        return 0;
+    }
+    if(ret >= 0){
+        printk(KERN_INFO "%s: Synchgroup_read, device minor: %d, %zd bytes\n", KBUILD_MODNAME, MINOR(file->f_path.dentry->d_inode->i_rdev), ret);
+    }
+    return ret;
+}
+
+#ifdef SYNCHMESS_URING_CMD
+//command of io_uring waiting for a message or a barrier release on a group
+struct synchgroup_uring_wait {
+    //entry on the read or sleep queue of the group, its wake function runs the command again in the task of the submitter
+    wait_queue_t wait;
+    //queue the entry is added to
+    wait_queue_head_t *head;
+    struct io_uring_cmd *cmd;
+    struct synchgroup_session *session;
+    //buffer of SYNCHMESS_URING_RECEIVE, batch_info of SYNCHMESS_URING_RECEIVE_BATCH
+    void __user *addr;
+    size_t len;
+    //barrier generation when the command was submitted
+    unsigned long generation;
+    //held by the command until it completes, and by synchgroup_uring_arm while it checks the group
+    refcount_t ref;
+};
+
+static void synchgroup_uring_task(struct io_uring_cmd *cmd, unsigned int issue_flags);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,15,0)
+//since 6.15 the task work of a command gets an io_tw_token_t, the command completes with IO_URING_CMD_TASK_WORK_ISSUE_FLAGS
+static void synchgroup_uring_task_work(struct io_uring_cmd *cmd, io_tw_token_t tw){
+    synchgroup_uring_task(cmd, IO_URING_CMD_TASK_WORK_ISSUE_FLAGS);
+}
+#else
+#define synchgroup_uring_task_work synchgroup_uring_task
+#endif
+
+//the command keeps its synchgroup_uring_wait in the pdu
+static inline struct synchgroup_uring_wait **synchgroup_uring_pdu(struct io_uring_cmd *cmd){
+    return (struct synchgroup_uring_wait **)cmd->pdu;
+}
+
+static void synchgroup_uring_put(struct synchgroup_uring_wait *w){
+    if(refcount_dec_and_test(&w->ref)){
+        kfree(w);
+    }
+}
+
+//remove the entry from its queue. Returns true if it was still queued, then the caller completes the command
+static bool synchgroup_uring_detach(struct synchgroup_uring_wait *w){
+    unsigned long flags;
+    bool queued;
+    
+    spin_lock_irqsave(&w->head->lock, flags);
+    queued = !list_empty(&w->wait.entry);
+    list_del_init(&w->wait.entry);
+    spin_unlock_irqrestore(&w->head->lock, flags);
+    return queued;
+}
+
+//wake function of the entry, called with the lock of the queue held: the command runs in the task of the submitter
+static int synchgroup_uring_wake(wait_queue_t *wait, unsigned int mode, int sync, void *key){
+    struct synchgroup_uring_wait *w = container_of(wait, struct synchgroup_uring_wait, wait);
+    
+    list_del_init(&wait->entry);
+    io_uring_cmd_complete_in_task(w->cmd, synchgroup_uring_task_work);
+    return 1;
+}
+
+//result of the command, -EAGAIN if it has to wait
+static ssize_t synchgroup_uring_try(struct synchgroup_uring_wait *w){
+    struct group_dev *entry = w->session->group;
+    batch_info batch;
+    ssize_t ret;
+    
+    switch(w->cmd->cmd_op){
+        case SYNCHMESS_URING_BARRIER_WAIT:
+            return READ_ONCE(entry->barrier_generation) != w->generation ? 0 : -EAGAIN;
+            
+        case SYNCHMESS_URING_RECEIVE_BATCH:
+            if(copy_from_user(&batch, w->addr, sizeof(batch_info))){
+                return -EFAULT;
+            }
+            ret = session_read_batch_to_user(w->session, u64_to_user_ptr(batch.buf), min_t(u64, batch.len, SIZE_MAX), batch.max_messages, &batch.messages);
+            if(ret >= 0 && copy_to_user(w->addr, &batch, sizeof(batch_info))){
+                ret = -EFAULT;
+            }
+            break;
+            
+        default:
+            ret = session_read_to_user(w->session, w->addr, w->len);
+    }
+    return ret == -ENODATA ? -EAGAIN : ret;
+}
+
+//true if the command may complete now
+static bool synchgroup_uring_ready(struct synchgroup_uring_wait *w){
+    struct group_dev *entry = w->session->group;
+    bool ready;
+    
+    if(w->cmd->cmd_op == SYNCHMESS_URING_BARRIER_WAIT){
+        return READ_ONCE(entry->barrier_generation) != w->generation;
+    }
+    mutex_lock(&entry->group_lock);
+    synchgroup_expire_messages(entry);
+    ready = synchgroup_has_messages(w->session);
+    mutex_unlock(&entry->group_lock);
+    return ready;
+}
+
+//queue the command on the group. It is checked once queued, so a message or a release in between is not lost
+static void synchgroup_uring_arm(struct synchgroup_uring_wait *w){
+    refcount_inc(&w->ref);
+    add_wait_queue(w->head, &w->wait);
+    if(synchgroup_uring_ready(w) && synchgroup_uring_detach(w)){
+        io_uring_cmd_complete_in_task(w->cmd, synchgroup_uring_task_work);
+    }
+    synchgroup_uring_put(w);
+}
+
+//run the command in the task of the submitter, where the user memory can be accessed.
+//If another reader took the message it waits again
+static void synchgroup_uring_task(struct io_uring_cmd *cmd, unsigned int issue_flags){
+    struct synchgroup_uring_wait *w = *synchgroup_uring_pdu(cmd);
+    ssize_t ret;
+    
+    ret = synchgroup_uring_try(w);
+    if(ret == -EAGAIN){
+        synchgroup_uring_arm(w);
+        return;
+    }
+    synchmess_uring_cmd_done(cmd, ret, issue_flags);
+    synchgroup_uring_put(w);
+}
+
+//file operation to manage the io_uring commands on groups(SYNCHMESS_URING_SEND, SYNCHMESS_URING_SEND_KEYED, SYNCHMESS_URING_RECEIVE, SYNCHMESS_URING_RECEIVE_BATCH, SYNCHMESS_URING_BARRIER_WAIT).
+//Sends complete at once, receives and barrier waits complete when the group is ready without blocking the submitter
+int synchgroup_uring_cmd(struct io_uring_cmd *cmd, unsigned int issue_flags){
+    struct synchgroup_session *session = cmd->file->private_data;
+    struct group_dev *entry = session->group;
+    struct synchgroup_uring_wait *w;
+    ssize_t ret;
+    
+    if(issue_flags & IO_URING_F_CANCEL){
+        //the ring is exiting, unless the command is already running in the task of the submitter
+        w = *synchgroup_uring_pdu(cmd);
+        if(synchgroup_uring_detach(w)){
+            synchmess_uring_cmd_done(cmd, -ECANCELED, issue_flags);
+            synchgroup_uring_put(w);
+        }
+        return 0;
+    }
+    
+    switch(cmd->cmd_op){
+        case SYNCHMESS_URING_SEND:
+        case SYNCHMESS_URING_SEND_KEYED:
+            return synchgroup_send_info(session, u64_to_user_ptr(READ_ONCE(cmd->sqe->addr)), cmd->cmd_op == SYNCHMESS_URING_SEND_KEYED);
+            
+        case SYNCHMESS_URING_RECEIVE:
+        case SYNCHMESS_URING_RECEIVE_BATCH:
+        case SYNCHMESS_URING_BARRIER_WAIT:
+            break;
+            
+        default:
+            return -EINVAL;
+    }
+    
+    w = kzalloc(sizeof(*w), GFP_KERNEL);
+    if(w == NULL){
+        return -ENOMEM;
+    }
+    init_waitqueue_func_entry(&w->wait, synchgroup_uring_wake);
+    w->head = cmd->cmd_op == SYNCHMESS_URING_BARRIER_WAIT ? &entry->sleep_queue : &entry->read_queue;
+    w->cmd = cmd;
+    w->session = session;
+    //the sqe is read only at submission
+    w->addr = u64_to_user_ptr(READ_ONCE(cmd->sqe->addr));
+    w->len = READ_ONCE(cmd->sqe->len);
+    //releases before the submission are not counted
+    w->generation = READ_ONCE(entry->barrier_generation);
+    refcount_set(&w->ref, 1);
+    *synchgroup_uring_pdu(cmd) = w;
+    
+    //a message already stored completes the command inline
+    ret = synchgroup_uring_try(w);
+    if(ret != -EAGAIN){
+        kfree(w);
+        return ret;
+    }
+    io_uring_cmd_mark_cancelable(cmd, issue_flags);
+    synchgroup_uring_arm(w);
+    return -EIOCBQUEUED;
+}
+#endif
+
+//expired messages of the queues of a group, the ones synchgroup_expire_messages frees. The records of a ring
+//are not counted, the ring is not freed with them. Called with group_lock held
+static unsigned long group_count_expired(struct group_dev *entry){
+    struct message_t *message;
+    unsigned long count = 0;
+    u64 now = ktime_get_ns();
+    
+    list_for_each_entry(message, &entry->age_list, age_list){
+        if(!group_message_expired(entry, message->visible_ns, now)){
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+//number of messages the shrinker can free: the droppable ones and the ones already older than the TTL.
+//The shrinker is not memcg aware: it runs on global memory pressure, not when a single memcg hits its limit
+static unsigned long synchmess_shrink_count(struct shrinker *shrinker, struct shrink_control *sc){
+    struct list_head *ptr;
+    struct group_dev *entry;
+    unsigned long count = 0;
+    
+    if(!mutex_trylock(&group_list_lock)){
+        return 0;
+    }
+    list_for_each(ptr,&group_list){
+        entry = list_entry(ptr,struct group_dev, list);
+        //read without group_lock, the count is only an estimate
+        count += READ_ONCE(entry->droppable);
+        //the expired messages are at the head of age_list, groups in use are skipped as scan does
+        if(READ_ONCE(entry->ttl_ns) && mutex_trylock(&entry->group_lock)){
+            count += group_count_expired(entry);
+            mutex_unlock(&entry->group_lock);
+        }
+    }
+    mutex_unlock(&group_list_lock);
+    return count ? count : SHRINK_EMPTY;
+}
+
+//free the expired messages and then the droppable ones. Groups in use are skipped, reclaim never waits for them
+static unsigned long synchmess_shrink_scan(struct shrinker *shrinker, struct shrink_control *sc){
+    struct list_head *ptr;
+    struct group_dev *entry;
+    unsigned long freed = 0;
+    unsigned long expired;
+    size_t bytes = 0;
+    
+    if(!mutex_trylock(&group_list_lock)){
+        return SHRINK_STOP;
+    }
+    list_for_each(ptr,&group_list){
+        if(freed >= sc->nr_to_scan){
+            break;
+        }
+        entry = list_entry(ptr,struct group_dev, list);
+        if(!mutex_trylock(&entry->group_lock)){
+            continue;
+        }
+        expired = entry->expired;
+        bytes += synchgroup_expire_messages(entry);
+        freed += entry->expired - expired;
+        if(freed < sc->nr_to_scan){
+            expired = synchgroup_reclaim_messages(entry, sc->nr_to_scan - freed, &bytes);
+            entry->reclaimed += expired;
+            freed += expired;
+        }
+        mutex_unlock(&entry->group_lock);
+    }
+    //concurrent scans are serialized by group_list_lock
+    reclaimed_bytes += bytes;
+    mutex_unlock(&group_list_lock);
+    return freed ? freed : SHRINK_STOP;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+static struct shrinker *synchmess_shrinker;
+#else
+static struct shrinker synchmess_shrinker_struct = {
+	count_objects: synchmess_shrink_count,
+	scan_objects: synchmess_shrink_scan,
+	seeks: DEFAULT_SEEKS
+};
+static struct shrinker *synchmess_shrinker = &synchmess_shrinker_struct;
+#endif
+
+//register the shrinker of queued messages
+static int synchmess_register_shrinker(void){
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+    synchmess_shrinker = shrinker_alloc(0, "synchmess");
+    if(synchmess_shrinker == NULL){
+        return -ENOMEM;
+    }
+    synchmess_shrinker->count_objects = synchmess_shrink_count;
+    synchmess_shrinker->scan_objects = synchmess_shrink_scan;
+    synchmess_shrinker->seeks = DEFAULT_SEEKS;
+    shrinker_register(synchmess_shrinker);
+    return 0;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+    return register_shrinker(synchmess_shrinker, "synchmess");
+#else
+    return register_shrinker(synchmess_shrinker);
+#endif
+}
+
+static void synchmess_unregister_shrinker(void){
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+    shrinker_free(synchmess_shrinker);
+#else
+    unregister_shrinker(synchmess_shrinker);
+#endif
+}
+
+//delay of the next sweep, sweep_interval_millis is writable so it is clamped here
+static unsigned long sweep_interval(void){
+    return msecs_to_jiffies(max(READ_ONCE(sweep_interval_millis), SWEEP_INTERVAL_MIN_MILLIS));
+}
+
+/*Workqueue Function that removes the expired messages of all the groups*/
+static void workqueue_sweep(struct work_struct *work){
+    struct list_head *ptr;
+    struct group_dev *entry;
+    
+    mutex_lock(&group_list_lock);
+    list_for_each(ptr,&group_list){
+        entry = list_entry(ptr,struct group_dev, list);
+        if(READ_ONCE(entry->ttl_ns) == 0){
+            continue;
+        }
+        //a busy group is skipped, as in synchmess_shrink_scan: its holder may be faulting on a user copy,
+        //and waiting for it with group_list_lock held would block open and the lookup of every group.
+        //Its expired messages are removed by its next read or by the next sweep
+        if(!mutex_trylock(&entry->group_lock)){
+            continue;
+        }
+        synchgroup_expire_messages(entry);
+        mutex_unlock(&entry->group_lock);
+    }
+    mutex_unlock(&group_list_lock);
+    
+    schedule_delayed_work(&sweep_work, sweep_interval());
+}
+
+ssize_t synchgroup_write (struct file * file, const char __user *buf, size_t count, loff_t *offset){
+    struct synchgroup_session *session = file->private_data;
+    
+    printk(KERN_INFO "%s: Synchgroup_write, minor=%d\n", KBUILD_MODNAME, MINOR(file->f_path.dentry->d_inode->i_rdev));
+    
+    //messages written without a key are not partitioned and go in the lowest lane
+    return synchgroup_send(session, buf, count, -1, 0, false, group_delay_deadline(session->group, ktime_get_ns()));
+}
+
+//Search the group with the given name in the list of group_dev
+static struct group_dev *find_group_by_name_locked(const char *name){
+    char group_dev_name[32];
+    struct list_head *ptr;
+    struct group_dev *entry;
+    
+    snprintf(group_dev_name,sizeof(group_dev_name),"synch!synchgroup_%s", name);
+    list_for_each(ptr,&group_list){
+        entry=list_entry(ptr,struct group_dev, list);
+        if(strcmp(entry->group_dev_name, group_dev_name) == 0){
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+//Search the group with the given name in the list of group_dev
+static struct group_dev *find_group_by_name(const char *name){
+    struct group_dev *entry;
+    
+    mutex_lock(&group_list_lock);
+    entry = find_group_by_name_locked(name);
+    mutex_unlock(&group_list_lock);
+    return entry;
+}
+
+//install the group with the given name if it does not exist, the group is returned in group.
+//Called with group_list_lock held, so a group is installed only once
+static int synchmess_install_group(const char *name, struct group_dev **group){
+    struct device *synchgroup_device;
+    char group_dev_name[32];
+    struct group_dev *temp;
+    int next_minor;
+    int ret;
+    
+    temp = find_group_by_name_locked(name);
+    if(temp != NULL){
+        *group = temp;
+        return 0;
+    }
+    
+    snprintf(group_dev_name,sizeof(group_dev_name),"synch!synchgroup_%s", name);
+    
+    //minor for the new group is groups_number +1
+    next_minor = atomic_inc_return(&groups_number);
+    printk(KERN_INFO "%s: next_minor = %d\n", KBUILD_MODNAME, next_minor);
+    
+    //create a group_dev to be inserted in the list of groups
+    temp = kmalloc(sizeof(*temp),GFP_KERNEL);
+    if(temp == NULL){
+        return -ENOMEM;
+    }
+    ret = synchgroup_init(temp, name, MKDEV(synchgroup_major, next_minor));
+    if(ret){
+        kfree(temp);
+        return ret;
+    }
+    
+    // Create a device in the previously created class
+    synchgroup_device = device_create(synchgroup_dev_cl, NULL, temp->devt, NULL, group_dev_name);
+    if (IS_ERR(synchgroup_device)) {
+        printk(KERN_ERR "%s: failed to create device synchgroup\n", KBUILD_MODNAME);
+        synchgroup_destroy(temp);
+        kfree(temp);
+        return PTR_ERR(synchgroup_device);
+    }
+    printk(KERN_INFO "%s: special device synchgroup registered with major number %d\n", KBUILD_MODNAME, synchgroup_major);
+    
+    //add the group to the list of group, once it is initialized
+    list_add_tail(&temp->list,&group_list);
+    *group = temp;
+    return 0;
+}
+
+//bitmap of the groups with a message or a barrier release. Read without group_lock, as poll does
+static unsigned long long wait_any_ready(wait_any_info *info, struct group_dev **groups, unsigned long *generations){
+    unsigned long long ready = 0;
+    unsigned int i;
+    
+    for(i = 0; i < info->count; i++){
+        //lane_depth[0] counts the messages of the ring
+        if((info->flags & SYNCHMESS_WAIT_MESSAGE) && (READ_ONCE(groups[i]->message_list.lane_bitmap) || (READ_ONCE(groups[i]->ring) && READ_ONCE(groups[i]->lane_depth[0])))){
+            ready |= 1ULL << i;
+        }
+        if((info->flags & SYNCHMESS_WAIT_BARRIER) && READ_ONCE(groups[i]->barrier_generation) != generations[i]){
+            ready |= 1ULL << i;
+        }
+    }
+    return ready;
+}
+
+//groups of a WAIT_ANY, checked while spinning
+struct wait_any_spin {
+    wait_any_info *info;
+    struct group_dev **groups;
+    unsigned long *generations;
+};
+
+static bool wait_any_spin_ready(void *data){
+    struct wait_any_spin *spin = data;
+    
+    return wait_any_ready(spin->info, spin->groups, spin->generations) != 0;
+}
+
+//spin for the largest budget of the groups, before sleeping. Returns the ready groups, 0 if none
+static unsigned long long wait_any_spin(wait_any_info *info, struct group_dev **groups, unsigned long *generations){
+    struct wait_any_spin spin = { info, groups, generations };
+    unsigned long long spinning = 0;
+    unsigned long long ready;
+    u64 budget = 0;
+    bool hit;
+    unsigned int i;
+    
+    for(i = 0; i < info->count; i++){
+        if(synchgroup_spin_begin(groups[i])){
+            spinning |= 1ULL << i;
+            budget = max_t(u64, budget, READ_ONCE(groups[i]->spin_ns));
+        }
+    }
+    if(spinning == 0){
+        return 0;
+    }
+    hit = synchmess_spin(budget, wait_any_spin_ready, &spin);
+    ready = hit ? wait_any_ready(info, groups, generations) : 0;
+    //only the groups that became ready count a hit, the spin was a miss for the others
+    for(i = 0; i < info->count; i++){
+        if(spinning & (1ULL << i)){
+            synchgroup_spin_end(groups[i], ready & (1ULL << i));
+        }
+    }
+    return ready;
+}
+
+//wait until any of the groups has a message or a barrier release, and optionally read the message
+static long synchmess_wait_any(wait_any_info __user *arg){
+    wait_any_info info;
+    group_t *names = NULL;
+    struct group_dev **groups = NULL;
+    unsigned long *generations = NULL;
+    wait_queue_t *waits = NULL;
+    struct synchgroup_session session;
+    unsigned long long ready;
+    long timeout;
+    long ret = 0;
+    unsigned int i;
+    
+    if(copy_from_user(&info, arg, sizeof(wait_any_info))){
+        return -EFAULT;
+    }
+    if(info.count == 0 || info.count > SYNCHMESS_WAIT_ANY_MAX){
+        return -EINVAL;
+    }
+    if(!(info.flags & (SYNCHMESS_WAIT_MESSAGE | SYNCHMESS_WAIT_BARRIER))){
+        info.flags |= SYNCHMESS_WAIT_MESSAGE;
+    }
+    
+    names = kmalloc_array(info.count, sizeof(*names), GFP_KERNEL);
+    groups = kmalloc_array(info.count, sizeof(*groups), GFP_KERNEL);
+    generations = kmalloc_array(info.count, sizeof(*generations), GFP_KERNEL);
+    //one entry on the read queue and one on the sleep queue of each group
+    waits = kmalloc_array(info.count * 2, sizeof(*waits), GFP_KERNEL);
+    if(names == NULL || groups == NULL || generations == NULL || waits == NULL){
+        ret = -ENOMEM;
+        goto out_free;
+    }
+    if(copy_from_user(names, u64_to_user_ptr(info.groups), info.count * sizeof(*names))){
+        ret = -EFAULT;
+        goto out_free;
+    }
+    for(i = 0; i < info.count; i++){
+        names[i].name[sizeof(names[i].name) - 1] = 0;
+        groups[i] = find_group_by_name(names[i].name);
+        if(groups[i] == NULL){
+            ret = -ENOENT;
+            goto out_free;
+        }
+        //releases before the call are not counted
+        generations[i] = READ_ONCE(groups[i]->barrier_generation);
+    }
+    
+    //msecs_to_jiffies takes an unsigned int, longer timeouts saturate as it does with the ones it cannot convert
+    if(info.timeout_millis < 0){
+        timeout = MAX_SCHEDULE_TIMEOUT;
+    } else if(info.timeout_millis > UINT_MAX){
+        timeout = MAX_JIFFY_OFFSET;
+    } else {
+        timeout = msecs_to_jiffies(info.timeout_millis);
+    }
+    
+    //a group ready within the spin budget does not need a context switch
+    ready = wait_any_ready(&info, groups, generations);
+    if(ready == 0 && timeout != 0){
+        ready = wait_any_spin(&info, groups, generations);
+    }
+    if(ready){
+        goto out_ready;
+    }
+    
+    for(i = 0; i < info.count; i++){
+        init_waitqueue_entry(&waits[2 * i], current);
+        add_wait_queue(&groups[i]->read_queue, &waits[2 * i]);
+        init_waitqueue_entry(&waits[2 * i + 1], current);
+        add_wait_queue(&groups[i]->sleep_queue, &waits[2 * i + 1]);
+    }
+    for(;;){
+        //the state is set before the check, so a wake up after the check is not lost
+        set_current_state(TASK_INTERRUPTIBLE);
+        ready = wait_any_ready(&info, groups, generations);
+        if(ready || timeout == 0 || signal_pending(current)){
+            break;
+        }
+        timeout = schedule_timeout(timeout);
+    }
+    __set_current_state(TASK_RUNNING);
+    for(i = 0; i < info.count; i++){
+        remove_wait_queue(&groups[i]->read_queue, &waits[2 * i]);
+        remove_wait_queue(&groups[i]->sleep_queue, &waits[2 * i + 1]);
+    }
+    
+    if(!ready && !signal_pending(current)){
+        ret = -ETIMEDOUT;
+        goto out_free;
+    }
+    if(!ready){
+        //the restarted call waits only for the rest of the timeout. A saturated timeout is left as it is
+        if(info.timeout_millis >= 0 && info.timeout_millis <= UINT_MAX){
+            info.timeout_millis = jiffies_to_msecs(timeout);
+            if(copy_to_user(&arg->timeout_millis, &info.timeout_millis, sizeof(info.timeout_millis))){
+                ret = -EFAULT;
+                goto out_free;
+            }
+        }
+        ret = -ERESTARTSYS;
+        goto out_free;
+    }
+    
+out_ready:
+    info.ready = ready;
+    info.index = -1;
+    if(info.flags & SYNCHMESS_WAIT_DEQUEUE){
+        //read from the first ready group that still has a message
+        ret = -ENODATA;
+        for(i = 0; i < info.count && ret == -ENODATA; i++){
+            if(!(ready & (1ULL << i))){
+                continue;
+            }
+            synchgroup_session_init(&session, groups[i]);
+            ret = session_read_to_user(&session, u64_to_user_ptr(info.buf), min_t(u64, info.len, SIZE_MAX));
+            if(ret >= 0){
+                info.index = i;
+            }
+        }
+        if(ret == -ENODATA){
+            info.len = 0;
+        } else if(ret < 0){
+            goto out_free;
+        } else {
+            info.len = ret;
+        }
+        ret = 0;
+    }
+    if(copy_to_user(arg, &info, sizeof(wait_any_info))){
+        ret = -EFAULT;
+    }
+    
+out_free:
+    kfree(names);
+    kfree(groups);
+    kfree(generations);
+    kfree(waits);
+    return ret;
+}
+
+//write all the groups, their settings and their stored and delayed messages to the user.
+//If the buffer is too small -ENOSPC is returned, with the size of the snapshot in len
+static long synchmess_dump(snapshot_info __user *arg){
+    snapshot_info info;
+    struct snapshot_stream stream;
+    snapshot_header header;
+    struct group_dev *entry;
+    
+    if(copy_from_user(&info, arg, sizeof(snapshot_info))){
+        return -EFAULT;
+    }
+    if(synchmess_snapshot_stream_init(&stream, u64_to_user_ptr(info.buf), NULL, min_t(u64, info.len, SIZE_MAX))){
+        return -ENOMEM;
+    }
+    info.groups = 0;
+    info.messages = 0;
+    info.dropped = 0;
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = SYNCHMESS_SNAPSHOT_MAGIC;
+    header.version = SYNCHMESS_SNAPSHOT_VERSION;
+    
+    //no group is installed during the dump
+    mutex_lock(&group_list_lock);
+    list_for_each_entry(entry, &group_list, list){
+        header.groups++;
+    }
+    synchmess_snapshot_write(&stream, &header, sizeof(header));
+    
+    list_for_each_entry(entry, &group_list, list){
+        mutex_lock(&entry->group_lock);
+        //the group name follows the prefix of group_dev_name
+        info.messages += synchmess_snapshot_dump_group(&stream, entry, entry->group_dev_name + strlen("synch!synchgroup_"));
+        info.groups++;
+        mutex_unlock(&entry->group_lock);
+    }
+    mutex_unlock(&group_list_lock);
+    
+    if(stream.err == 0){
+        synchmess_snapshot_flush(&stream);
+    }
+    synchmess_snapshot_stream_destroy(&stream);
+    if(stream.err == -EFAULT){
+        return -EFAULT;
+    }
+    info.len = stream.size;
+    if(copy_to_user(arg, &info, sizeof(snapshot_info))){
+        return -EFAULT;
+    }
+    return stream.err;
+}
+
+//recreate the groups of a snapshot written by DUMP_GROUPS. Groups that already exist keep their
+//messages, the restored ones are added after them
+static long synchmess_restore(snapshot_info __user *arg){
+    snapshot_info info;
+    struct snapshot_stream stream;
+    snapshot_header header;
+    snapshot_group record;
+    struct group_dev *entry;
+    unsigned int i;
+    int err;
+    
+    if(copy_from_user(&info, arg, sizeof(snapshot_info))){
+        return -EFAULT;
+    }
+    if(synchmess_snapshot_stream_init(&stream, u64_to_user_ptr(info.buf), NULL, min_t(u64, info.len, SIZE_MAX))){
+        return -ENOMEM;
+    }
+    info.groups = 0;
+    info.messages = 0;
+    info.dropped = 0;
+    
+    err = synchmess_snapshot_read(&stream, &header, sizeof(header));
+    if(err == 0 && (header.magic != SYNCHMESS_SNAPSHOT_MAGIC || header.version < 1 || header.version > SYNCHMESS_SNAPSHOT_VERSION)){
+        err = -EINVAL;
+    }
+    for(i = 0; err == 0 && i < header.groups; i++){
+        memset(&record, 0, sizeof(record));
+        err = synchmess_snapshot_read(&stream, &record, snapshot_group_size(header.version));
+        if(err){
+            break;
+        }
+        record.group.name[sizeof(record.group.name) - 1] = 0;
+        mutex_lock(&group_list_lock);
+        err = synchmess_install_group(record.group.name, &entry);
+        mutex_unlock(&group_list_lock);
+        if(err){
+            break;
+        }
+        
+        //the whole group is restored with a single lock, readers are woken up once at the end
+        mutex_lock(&entry->group_lock);
+        err = synchmess_snapshot_restore_group(&stream, entry, header.version, &record, &info);
+        mutex_unlock(&entry->group_lock);
+        wake_up_interruptible(&entry->read_queue);
+        info.groups++;
+    }
+    
+    //bytes of the snapshot restored
+    info.len = synchmess_snapshot_read_bytes(&stream);
+    synchmess_snapshot_stream_destroy(&stream);
+    if(copy_to_user(arg, &info, sizeof(snapshot_info))){
+        return -EFAULT;
+    }
+    return err;
+}
+
+//file operation to manage the creation of a group
+long synchmess_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	long ret = 0;
+    //struct to exchange data with the client
+	ioctl_info info;
+    char group_dev_file_name[32];
+    struct group_dev *temp;
+    
+
+	switch (cmd) {
+        case IOCTL_INSTALL_GROUP:
+			printk(KERN_INFO "%s: IOCTL INSTALL GROUP operation, synchmess device.\n", KBUILD_MODNAME);
+            
+			if(copy_from_user(&info, (ioctl_info *)arg, sizeof(ioctl_info))){
+                ret = -EFAULT;
+                goto out;
+            }
+            info.group.name[sizeof(info.group.name) - 1] = 0;
+			printk(KERN_INFO "%s: IOCTL INSTALL GROUP operation, Group name: %s\n", KBUILD_MODNAME, info.group.name);
+            
+            snprintf(group_dev_file_name,sizeof(group_dev_file_name),"/dev/synch/synchgroup_%s",info.group.name);
+            
+            //the group is created only if it doesn't exist
+            mutex_lock(&group_list_lock);
+            ret = synchmess_install_group(info.group.name, &temp);
+            mutex_unlock(&group_list_lock);
+            if(ret){
+                goto out;
+            }
+            
+            //copy the file path of the file associated with the group in info
+            strcpy(info.file_path, group_dev_file_name);
+            //copy_to_user to make the file path available to the client
+            if(copy_to_user((ioctl_info *)arg, &info, sizeof(ioctl_info))){
+                ret = -EFAULT;
+            }
+            
+			goto out;
+            
+        case WAIT_ANY:
+            printk(KERN_INFO "%s: WAIT ANY operation, synchmess device.\n", KBUILD_MODNAME);
+            ret = synchmess_wait_any((wait_any_info *)arg);
+            goto out;
+            
+        case DUMP_GROUPS:
+            printk(KERN_INFO "%s: DUMP GROUPS operation, synchmess device.\n", KBUILD_MODNAME);
+            //the snapshot has the messages of every group
+            if(!capable(CAP_SYS_ADMIN)){
+                ret = -EPERM;
+                goto out;
+            }
+            ret = synchmess_dump((snapshot_info *)arg);
+            goto out;
+            
+        case RESTORE_GROUPS:
+            printk(KERN_INFO "%s: RESTORE GROUPS operation, synchmess device.\n", KBUILD_MODNAME);
+            //the restored messages keep the sender and sequence number written in the snapshot
+            if(!capable(CAP_SYS_ADMIN)){
+                ret = -EPERM;
+                goto out;
+            }
+            ret = synchmess_restore((snapshot_info *)arg);
+            goto out;
+	}
+
+    out:
+	return ret;
+}
+
+int synchmess_open(struct inode *inode, struct file *filp) {
+    printk(KERN_INFO "%s: Open operation, synchmess device.\n", KBUILD_MODNAME);
+	return 0;
+}
+
+
+int synchmess_release(struct inode *inode, struct file *filp){
+    printk(KERN_INFO "%s: Release operation, synchmess device.\n", KBUILD_MODNAME);
+	return 0;
+}
+
+// Variables to correctly setup/shutdown the pseudo device file for synchmess
+static int synchmess_major;
+static struct class *synchmess_dev_cl = NULL;
+static struct device *synchmess_device = NULL;
+
+
+static int __init synchmess_init(void){
+    int err;
+    
+    //init list of groups
+    INIT_LIST_HEAD(&group_list);
+    
+    printk(KERN_INFO "%s: Init module.\n", KBUILD_MODNAME);
+    
+    // Dynamically allocate a major for the synchmess device
+	synchmess_major = register_chrdev(0, KBUILD_MODNAME, &synchmess_fops);
+	if (synchmess_major < 0) {
+		printk(KERN_ERR "%s: Failed registering char device\n", KBUILD_MODNAME);
+		err = synchmess_major;
+		goto failed_chrdevreg;
+	}
+
+	// Create a class for the synchmess device
+	synchmess_dev_cl = synchmess_class_create("synchmess");
+	if (IS_ERR(synchmess_dev_cl)) {
+		printk(KERN_ERR "%s: failed to register device class\n", KBUILD_MODNAME);
+		err = PTR_ERR(synchmess_dev_cl);
+		goto failed_classreg;
+	}
+
+	// Create a device in the previously created class
+	synchmess_device = device_create(synchmess_dev_cl, NULL, MKDEV(synchmess_major, 0), NULL, KBUILD_MODNAME);
+	if (IS_ERR(synchmess_device)) {
+		printk(KERN_ERR "%s: failed to create device synchmess\n", KBUILD_MODNAME);
+		err = PTR_ERR(synchmess_device);
+		goto failed_devreg;
+	}
+
+	printk(KERN_INFO "%s: special device synchmess registered with major number %d\n", KBUILD_MODNAME, synchmess_major);
+
+    printk(KERN_INFO "%s: Init registering dev files representing groups.\n", KBUILD_MODNAME);
+    
+    // Dynamically allocate a major for the synchgroup device
+	synchgroup_major = register_chrdev(0, "synchgroup", &synchgroup_fops);
+	if (synchgroup_major < 0) {
+		printk(KERN_ERR "%s: Failed registering char device\n", KBUILD_MODNAME);
+		err = synchgroup_major;
+		goto failed_chrdevreg_synchgroup;
+	}
+
+	// Create a class for the synchgroup device
+	synchgroup_dev_cl = synchmess_class_create("synchgroup");
+	if (IS_ERR(synchgroup_dev_cl)) {
+		printk(KERN_ERR "%s: failed to register device class\n", KBUILD_MODNAME);
+		err = PTR_ERR(synchgroup_dev_cl);
+		goto failed_classreg_synchgroup;
+	}
+    
+    printk(KERN_INFO "%s: special device synchgroup registered with major number %d\n", KBUILD_MODNAME, synchgroup_major);
+
+    //init groups_number with 0
+    atomic_set(&groups_number, 0);
+    
+    //messages can be reclaimed under memory pressure
+    err = synchmess_register_shrinker();
+    if (err) {
+		printk(KERN_ERR "%s: failed to register the shrinker\n", KBUILD_MODNAME);
+		goto failed_shrinker;
+    }
+    
+    //start the periodic removal of expired messages
+    INIT_DELAYED_WORK(&sweep_work, workqueue_sweep);
+    schedule_delayed_work(&sweep_work, sweep_interval());
+    
+	return 0;
+
+failed_shrinker:
+    class_unregister(synchgroup_dev_cl);
+	class_destroy(synchgroup_dev_cl);
+failed_classreg_synchgroup:
+    unregister_chrdev(synchgroup_major, KBUILD_MODNAME);
+failed_chrdevreg_synchgroup:
+failed_devreg:
+	class_unregister(synchmess_dev_cl);
+	class_destroy(synchmess_dev_cl);
+failed_classreg:
+	unregister_chrdev(synchmess_major, KBUILD_MODNAME);
+failed_chrdevreg:
+	return err;// Non-zero return means that the module couldn't be loaded.
+}
+
+static void __exit synchmess_cleanup(void)
+{
+    struct list_head *ptr;
+    struct list_head* tmp;
+    struct group_dev *entry;
+    
+    printk(KERN_INFO "%s: Cleaning up module.\n", KBUILD_MODNAME);
+    
+    //destroy and unregister synchmess device
+    device_destroy(synchmess_dev_cl, MKDEV(synchmess_major, 0));
+	class_unregister(synchmess_dev_cl);
+	class_destroy(synchmess_dev_cl);
+	unregister_chrdev(synchmess_major, KBUILD_MODNAME);
+    
+    //stop the removal of expired messages
+    cancel_delayed_work_sync(&sweep_work);
+    synchmess_unregister_shrinker();
+    
+    //for each group
+    list_for_each_safe(ptr, tmp, &group_list){
+        entry = list_entry(ptr,struct group_dev, list);
+        
+        //destroy the device associated with the group
+        device_destroy(synchgroup_dev_cl, entry->devt);
+        
+        //free each message and each delayed message in the group
+        synchgroup_destroy(entry);
+        
+        //remove the group from the list
+        list_del(ptr);
+        //free memory
+        kfree(entry);
+    }
+    //unregister and destroy the class associated with synchgroup
+    class_unregister(synchgroup_dev_cl);
+	class_destroy(synchgroup_dev_cl);
+    //unregister the device associated with the group
+    unregister_chrdev(synchgroup_major, 0);
+    
+	printk(KERN_INFO "%s: Cleaning completed.\n", KBUILD_MODNAME);
+}
+
+module_init(synchmess_init);
+module_exit(synchmess_cleanup);
@@ -0,0 +1,246 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "synchmess-snapshot.h"
+
+//init a stream on a user or a kernel buffer
+int synchmess_snapshot_stream_init(struct snapshot_stream *stream, char __user *buf, char *kbuf, size_t len){
+    memset(stream, 0, sizeof(*stream));
+    stream->buf = buf;
+    stream->kbuf = kbuf;
+    stream->len = len;
+    stream->chunk = kmalloc(SNAPSHOT_CHUNK, GFP_KERNEL);
+    if(stream->chunk == NULL){
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void synchmess_snapshot_stream_destroy(struct snapshot_stream *stream){
+    kfree(stream->chunk);
+    stream->chunk = NULL;
+}
+
+//copy the kernel buffer of a dump to the buffer
+int synchmess_snapshot_flush(struct snapshot_stream *stream){
+    if(stream->kbuf != NULL){
+        memcpy(stream->kbuf + stream->offset, stream->chunk, stream->filled);
+    } else if(copy_to_user(stream->buf + stream->offset, stream->chunk, stream->filled)){
+        stream->err = -EFAULT;
+        return -EFAULT;
+    }
+    stream->offset += stream->filled;
+    stream->filled = 0;
+    return 0;
+}
+
+//append count bytes to a dump
+void synchmess_snapshot_write(struct snapshot_stream *stream, const void *src, size_t count){
+    size_t n;
+    
+    stream->size += count;
+    if(stream->err){
+        return;
+    }
+    if(stream->size > stream->len){
+        stream->err = -ENOSPC;
+        return;
+    }
+    while(count){
+        if(stream->filled == SNAPSHOT_CHUNK && synchmess_snapshot_flush(stream)){
+            return;
+        }
+        n = min_t(size_t, count, SNAPSHOT_CHUNK - stream->filled);
+        memcpy(stream->chunk + stream->filled, src, n);
+        stream->filled += n;
+        src += n;
+        count -= n;
+    }
+}
+
+//read the next count bytes of a restore, -EINVAL if the snapshot is truncated
+int synchmess_snapshot_read(struct snapshot_stream *stream, void *dst, size_t count){
+    size_t n;
+    
+    while(count){
+        if(stream->pos == stream->filled){
+            n = min_t(size_t, SNAPSHOT_CHUNK, stream->len - stream->offset);
+            if(n == 0){
+                return -EINVAL;
+            }
+            if(stream->kbuf != NULL){
+                memcpy(stream->chunk, stream->kbuf + stream->offset, n);
+            } else if(copy_from_user(stream->chunk, stream->buf + stream->offset, n)){
+                return -EFAULT;
+            }
+            stream->offset += n;
+            stream->filled = n;
+            stream->pos = 0;
+        }
+        n = min_t(size_t, count, stream->filled - stream->pos);
+        memcpy(dst, stream->chunk + stream->pos, n);
+        stream->pos += n;
+        dst += n;
+        count -= n;
+    }
+    return 0;
+}
+
+//bytes of a restore read so far, the ones in chunk not read yet are not counted
+size_t synchmess_snapshot_read_bytes(struct snapshot_stream *stream){
+    return stream->offset - (stream->filled - stream->pos);
+}
+
+//append a message record and its body to a dump
+static void snapshot_write_message(struct snapshot_stream *stream, struct message_t *message, int partition, u64 time_ns){
+    snapshot_message record;
+    
+    record.time_ns = time_ns;
+    record.len = message->len;
+    record.partition = partition;
+    record.priority = message->priority;
+    record.flags = message->droppable ? SYNCHMESS_SEND_DROPPABLE : 0;
+    record.seq = message->seq;
+    record.enqueue_ns = message->enqueue_ns;
+    record.tgid = message->tgid;
+    record.tid = message->tid;
+    synchmess_snapshot_write(stream, &record, sizeof(record));
+    synchmess_snapshot_write(stream, message->text, message->len);
+}
+
+//append a message of the ring and its body to a dump
+static void snapshot_write_ring_record(struct snapshot_stream *stream, struct ring_record *ring_record){
+    snapshot_message record;
+    
+    record.time_ns = ring_record->visible_ns;
+    record.len = ring_record->len;
+    record.partition = -1;
+    record.priority = 0;
+    record.flags = 0;
+    record.seq = ring_record->seq;
+    record.enqueue_ns = ring_record->enqueue_ns;
+    record.tgid = ring_record->tgid;
+    record.tid = ring_record->tid;
+    synchmess_snapshot_write(stream, &record, sizeof(record));
+    synchmess_snapshot_write(stream, (const char *)(ring_record + 1), ring_record->len);
+}
+
+//append a group and its messages to a dump. Called with group_lock held
+unsigned long synchmess_snapshot_dump_group(struct snapshot_stream *stream, struct group_dev *entry, const char *name){
+    snapshot_group record;
+    struct message_t *message;
+    struct delayed_work_params *params;
+    struct ring_record *ring_record;
+    u64 pos;
+    int i;
+    
+    //expired messages are not dumped
+    synchgroup_expire_messages(entry);
+    
+    memset(&record, 0, sizeof(record));
+    strncpy(record.group.name, name, sizeof(record.group.name) - 1);
+    record.timeout_millis = entry->timeout_millis;
+    record.ttl_ns = entry->ttl_ns;
+    for(i = 0; i < SYNCHMESS_PRIORITIES; i++){
+        record.messages += entry->lane_depth[i];
+    }
+    record.delayed = entry->delayed;
+    record.next_seq = entry->next_seq;
+    record.flags = entry->read_header ? SYNCHMESS_SNAPSHOT_READ_HEADER : 0;
+    record.spin_ns = READ_ONCE(entry->spin_ns);
+    if(entry->ring != NULL){
+        record.flags |= SYNCHMESS_SNAPSHOT_RING;
+    }
+    synchmess_snapshot_write(stream, &record, sizeof(record));
+    
+    //age_list keeps the order of each lane of each queue
+    list_for_each_entry(message, &entry->age_list, age_list){
+        snapshot_write_message(stream, message, message_partition(entry, message), message->visible_ns);
+    }
+    //the ring is written from the first record
+    pos = entry->ring_head;
+    while(entry->ring != NULL && (ring_record = synchgroup_ring_next(entry, &pos)) != NULL){
+        snapshot_write_ring_record(stream, ring_record);
+    }
+    list_for_each_entry(params, &entry->delayed_work_param_list, list){
+        snapshot_write_message(stream, params->message, params->partition, params->deadline);
+    }
+    return record.messages + record.delayed;
+}
+
+//read a message record of a restore and add the message to the group. A message that does not fit
+//in the storage of the group is counted in dropped. Called with group_lock held
+static int snapshot_restore_message(struct snapshot_stream *stream, struct group_dev *entry, unsigned int version, bool delayed, snapshot_info *info){
+    snapshot_message record;
+    struct message_t *message;
+    int err;
+    
+    //the fields added by version 2 are 0 in older snapshots
+    memset(&record, 0, sizeof(record));
+    err = synchmess_snapshot_read(stream, &record, version == 1 ? SYNCHMESS_SNAPSHOT_V1_MESSAGE_SIZE : sizeof(record));
+    if(err){
+        return err;
+    }
+    if(record.priority >= SYNCHMESS_PRIORITIES || record.partition < -1 || record.partition >= SYNCHMESS_PARTITIONS || record.len > stream->len){
+        return -EINVAL;
+    }
+    //a larger message could never be stored, and the length is not trusted for the allocation
+    if(record.len > synchmess_max_storage_size){
+        return -EINVAL;
+    }
+    message = synchmess_message_alloc(record.len, record.priority, record.flags & SYNCHMESS_SEND_DROPPABLE);
+    if(message == NULL){
+        return -ENOMEM;
+    }
+    err = synchmess_snapshot_read(stream, message->text, record.len);
+    if(err){
+        message_free(message);
+        return err;
+    }
+    message->seq = record.seq;
+    message->enqueue_ns = record.enqueue_ns;
+    message->tgid = record.tgid;
+    message->tid = record.tid;
+    if(delayed){
+        err = synchgroup_restore_delayed(entry, message, record.partition, record.time_ns);
+    } else {
+        message->visible_ns = record.time_ns;
+        err = synchgroup_restore_message(entry, message, record.partition);
+    }
+    if(err){
+        message_free(message);
+        if(err != -ENOSPC){
+            return err;
+        }
+        info->dropped++;
+        return 0;
+    }
+    info->messages++;
+    return 0;
+}
+
+//restore the settings and the messages of a group. Called with group_lock held
+int synchmess_snapshot_restore_group(struct snapshot_stream *stream, struct group_dev *entry, unsigned int version, snapshot_group *record, snapshot_info *info){
+    unsigned int i;
+    int err = 0;
+    
+    entry->timeout_millis = record->timeout_millis;
+    entry->ttl_ns = record->ttl_ns;
+    //sequence numbers are never reused
+    entry->next_seq = max(entry->next_seq, record->next_seq);
+    WRITE_ONCE(entry->read_header, !!(record->flags & SYNCHMESS_SNAPSHOT_READ_HEADER));
+    //a snapshot taken with a higher max_spin_ns is restored with the current maximum
+    synchgroup_set_spin_budget(entry, min_t(u64, record->spin_ns, READ_ONCE(synchmess_max_spin_ns)));
+    //a group that already has messages keeps its queues
+    if(record->flags & SYNCHMESS_SNAPSHOT_RING){
+        synchgroup_set_ring(entry, true);
+    }
+    for(i = 0; err == 0 && i < record->messages + record->delayed; i++){
+        err = snapshot_restore_message(stream, entry, version, i >= record->messages, info);
+    }
+    synchgroup_expire_messages(entry);
+    synchgroup_arm_delivery(entry);
+    return err;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "synchmess-core.h"
+
+//Encoding and decoding of the snapshots of DUMP_GROUPS and RESTORE_GROUPS, one group at a time.
+//The list of groups and their devices are managed by the caller.
+
+//size of the kernel buffer of a snapshot_stream
+#define SNAPSHOT_CHUNK (4 * PAGE_SIZE)
+
+//copy of a snapshot from or to a buffer through a kernel buffer, so each record is not a separate user copy
+struct snapshot_stream {
+    //user buffer of the snapshot
+    char __user *buf;
+    //kernel buffer of the snapshot, used instead of buf when set
+    char *kbuf;
+    //size of the buffer
+    size_t len;
+    //bytes of the buffer copied so far
+    size_t offset;
+    //kernel buffer of SNAPSHOT_CHUNK bytes
+    char *chunk;
+    //bytes of chunk in use
+    size_t filled;
+    //bytes of chunk already read
+    size_t pos;
+    //dump only: size of the snapshot, it keeps growing after the buffer is full
+    size_t size;
+    //dump only: first error, -ENOSPC if the buffer is too small
+    int err;
+};
+
+//size of the group records of a snapshot version, the fields added later are 0 in older snapshots
+static inline size_t snapshot_group_size(unsigned int version){
+    switch(version){
+        case 1:
+            return SYNCHMESS_SNAPSHOT_V1_GROUP_SIZE;
+        case 2:
+            return SYNCHMESS_SNAPSHOT_V2_GROUP_SIZE;
+        default:
+            return sizeof(snapshot_group);
+    }
+}
+
+//init a stream on the len bytes of the user buffer buf, or of the kernel buffer kbuf if it is not NULL
+int synchmess_snapshot_stream_init(struct snapshot_stream *stream, char __user *buf, char *kbuf, size_t len);
+//free the kernel buffer of a stream
+void synchmess_snapshot_stream_destroy(struct snapshot_stream *stream);
+//copy the rest of a dump to the buffer
+int synchmess_snapshot_flush(struct snapshot_stream *stream);
+//append count bytes to a dump
+void synchmess_snapshot_write(struct snapshot_stream *stream, const void *src, size_t count);
+//read the next count bytes of a restore, -EINVAL if the snapshot is truncated
+int synchmess_snapshot_read(struct snapshot_stream *stream, void *dst, size_t count);
+//bytes of a restore read so far
+size_t synchmess_snapshot_read_bytes(struct snapshot_stream *stream);
+
+//append the record of the group called name, then its stored and delayed messages, to a dump.
+//Returns the number of messages. Called with group_lock held
+unsigned long synchmess_snapshot_dump_group(struct snapshot_stream *stream, struct group_dev *entry, const char *name);
+//restore the settings of a group record of the given version, already read, and read its messages into
+//the group. The messages are counted in info. Called with group_lock held
+int synchmess_snapshot_restore_group(struct snapshot_stream *stream, struct group_dev *entry, unsigned int version, snapshot_group *record, snapshot_info *info);
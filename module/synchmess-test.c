@@ -0,0 +1,1281 @@
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/perf_event.h>
+#include <linux/vmalloc.h>
+
+#include "synchmess-core.h"
+#include "synchmess-snapshot.h"
+
+//KUnit tests and microbenchmarks of the core of the subsystem, linked in the module when
+//CONFIG_SYNCHMESS_KUNIT_TEST is set (or with make KUNIT=1) and run when the module is loaded.
+//The microbenchmarks call the core directly, so they measure the cost of the data structures
+//without the syscall and the copy from/to user.
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,0,0)
+#error "kunit_test_suites() in a module with its own module_init needs Linux 6.0 or newer"
+#endif
+
+//messages stored by the tests are far below this, the microbenchmarks raise it
+static int saved_max_storage_size;
+
+//create the group used by a test, destroyed by synchmess_test_exit
+static int synchmess_test_init(struct kunit *test){
+    struct group_dev *entry;
+
+    entry = kunit_kzalloc(test, sizeof(*entry), GFP_KERNEL);
+    if(entry == NULL){
+        return -ENOMEM;
+    }
+    if(synchgroup_init(entry, "kunit", 0)){
+        return -ENOMEM;
+    }
+    saved_max_storage_size = synchmess_max_storage_size;
+    test->priv = entry;
+    return 0;
+}
+
+static void synchmess_test_exit(struct kunit *test){
+    synchgroup_destroy(test->priv);
+    synchmess_max_storage_size = saved_max_storage_size;
+}
+
+//send a copy of text, deadline 0 means no delay
+static int test_send(struct group_dev *entry, const char *text, int partition, int priority, bool droppable, u64 deadline){
+    struct message_t *message;
+
+    message = synchmess_message_alloc(strlen(text), priority, droppable);
+    if(message == NULL){
+        return -ENOMEM;
+    }
+    memcpy(message->text, text, strlen(text));
+    return synchgroup_send_message(entry, message, partition, deadline, NULL);
+}
+
+//send a copy of text delayed until deadline, as sent through the file of owner
+static int test_send_owned(struct group_dev *entry, struct synchgroup_session *owner, const char *text, u64 deadline){
+    struct message_t *message;
+
+    message = synchmess_message_alloc(strlen(text), 0, false);
+    if(message == NULL){
+        return -ENOMEM;
+    }
+    memcpy(message->text, text, strlen(text));
+    return synchgroup_send_message(entry, message, -1, deadline, owner);
+}
+
+//the next message of the session must be text
+static void test_expect_read(struct kunit *test, struct synchgroup_session *session, const char *text){
+    struct message_t *message;
+
+    message = synchgroup_read_message(session);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, message);
+    KUNIT_EXPECT_STREQ(test, message->text, text);
+    message_free(message);
+}
+
+//the session must have nothing to read
+static void test_expect_empty(struct kunit *test, struct synchgroup_session *session){
+    KUNIT_EXPECT_PTR_EQ(test, synchgroup_read_message(session), (struct message_t *)NULL);
+}
+
+static void synchmess_test_fifo(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+
+    synchgroup_session_init(&session, entry);
+    test_expect_empty(test, &session);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "first", -1, 0, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "second", -1, 0, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "third", -1, 0, false, 0), 0);
+    KUNIT_EXPECT_EQ(test, entry->storage_bytes, (size_t)16);
+    KUNIT_EXPECT_EQ(test, entry->lane_depth[0], 3UL);
+
+    test_expect_read(test, &session, "first");
+    test_expect_read(test, &session, "second");
+    test_expect_read(test, &session, "third");
+    test_expect_empty(test, &session);
+    KUNIT_EXPECT_EQ(test, entry->storage_bytes, (size_t)0);
+    KUNIT_EXPECT_EQ(test, entry->lane_depth[0], 0UL);
+}
+
+static void synchmess_test_priority(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+
+    synchgroup_session_init(&session, entry);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "low", -1, 0, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "high", -1, SYNCHMESS_PRIORITIES - 1, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "mid", -1, 1, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "low2", -1, 0, false, 0), 0);
+
+    test_expect_read(test, &session, "high");
+    test_expect_read(test, &session, "mid");
+    test_expect_read(test, &session, "low");
+    test_expect_read(test, &session, "low2");
+    test_expect_empty(test, &session);
+}
+
+static void synchmess_test_partitions(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session unkeyed;
+    struct synchgroup_session keyed;
+    unsigned long long key;
+
+    //the hash is stable and in range
+    for(key = 0; key < 1000; key++){
+        KUNIT_EXPECT_LT(test, synchmess_key_partition(key), SYNCHMESS_PARTITIONS);
+        KUNIT_EXPECT_EQ(test, synchmess_key_partition(key), synchmess_key_partition(key));
+    }
+
+    synchgroup_session_init(&unkeyed, entry);
+    synchgroup_session_init(&keyed, entry);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "p3-a", 3, 0, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "p5", 5, 0, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "unkeyed", -1, 0, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "p3-b", 3, 0, false, 0), 0);
+
+    //a reader of partition 3 sees only its messages, in order
+    keyed.partition_mask = 1UL << 3;
+    test_expect_read(test, &keyed, "p3-a");
+    test_expect_read(test, &keyed, "p3-b");
+    test_expect_empty(test, &keyed);
+
+    test_expect_read(test, &unkeyed, "unkeyed");
+    test_expect_empty(test, &unkeyed);
+
+    keyed.partition_mask = (1UL << 3) | (1UL << 5);
+    test_expect_read(test, &keyed, "p5");
+    test_expect_empty(test, &keyed);
+}
+
+static void synchmess_test_storage_full(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+
+    synchgroup_session_init(&session, entry);
+    synchmess_max_storage_size = 4;
+    KUNIT_ASSERT_EQ(test, test_send(entry, "abc", -1, 0, false, 0), 0);
+    KUNIT_EXPECT_EQ(test, test_send(entry, "de", -1, 0, false, 0), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, entry->storage_bytes, (size_t)3);
+
+    //reading frees the storage
+    test_expect_read(test, &session, "abc");
+    KUNIT_EXPECT_EQ(test, test_send(entry, "de", -1, 0, false, 0), 0);
+    test_expect_read(test, &session, "de");
+}
+
+static void synchmess_test_sequence(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    struct message_t *message;
+    u64 deadline;
+
+    synchgroup_session_init(&session, entry);
+    synchmess_max_storage_size = 4;
+    KUNIT_ASSERT_EQ(test, test_send(entry, "abc", -1, 0, false, 0), 0);
+    //the dropped message takes sequence number 1
+    KUNIT_EXPECT_EQ(test, test_send(entry, "de", -1, 0, false, 0), -ENOSPC);
+
+    message = synchgroup_read_message(&session);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, message);
+    KUNIT_EXPECT_EQ(test, message->seq, 0ULL);
+    KUNIT_EXPECT_EQ(test, message->tgid, current->tgid);
+    KUNIT_EXPECT_EQ(test, message->tid, current->pid);
+    KUNIT_EXPECT_LE(test, message->enqueue_ns, message->visible_ns);
+    message_free(message);
+
+    //a delayed message becomes visible at its deadline, after it was accepted
+    deadline = ktime_get_ns() + 10 * NSEC_PER_MSEC;
+    KUNIT_ASSERT_EQ(test, test_send(entry, "fg", -1, 0, false, deadline), 0);
+    msleep(20);
+    mutex_lock(&entry->group_lock);
+    synchgroup_flush_delayed(entry, 0, U64_MAX, false);
+    mutex_unlock(&entry->group_lock);
+    message = synchgroup_read_message(&session);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, message);
+    KUNIT_EXPECT_EQ(test, message->seq, 2ULL);
+    KUNIT_EXPECT_GE(test, message->visible_ns, deadline);
+    KUNIT_EXPECT_LT(test, message->enqueue_ns, deadline);
+    message_free(message);
+}
+
+static void synchmess_test_ttl(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+
+    synchgroup_session_init(&session, entry);
+    entry->ttl_ns = NSEC_PER_MSEC;
+    KUNIT_ASSERT_EQ(test, test_send(entry, "old", -1, 0, false, 0), 0);
+    msleep(5);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "fresh", -1, 0, false, 0), 0);
+
+    //the old message is removed by the send of the fresh one
+    KUNIT_EXPECT_EQ(test, entry->expired, 1UL);
+    KUNIT_EXPECT_EQ(test, entry->storage_bytes, (size_t)5);
+    test_expect_read(test, &session, "fresh");
+    test_expect_empty(test, &session);
+
+    //a TTL meaning forever does not wrap around
+    entry->ttl_ns = U64_MAX;
+    KUNIT_ASSERT_EQ(test, test_send(entry, "kept", -1, 0, false, 0), 0);
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchgroup_expire_messages(entry), (size_t)0);
+    mutex_unlock(&entry->group_lock);
+    test_expect_read(test, &session, "kept");
+}
+
+static void synchmess_test_delayed(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    //far enough that the delivery work does not run during the test
+    u64 base = ktime_get_ns() + 60 * NSEC_PER_SEC;
+
+    synchgroup_session_init(&session, entry);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "third", -1, 0, false, base + 3), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "first", -1, 0, false, base + 1), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "second", -1, 0, false, base + 2), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "fourth", -1, 0, false, base + 4), 0);
+    test_expect_empty(test, &session);
+
+    mutex_lock(&entry->group_lock);
+    //revoke the second, then store the ones up to the third in deadline order
+    KUNIT_EXPECT_EQ(test, synchgroup_flush_delayed(entry, base + 2, base + 2, true), 1L);
+    KUNIT_EXPECT_EQ(test, synchgroup_flush_delayed(entry, 0, base + 3, false), 2L);
+    synchgroup_arm_delivery(entry);
+    mutex_unlock(&entry->group_lock);
+
+    test_expect_read(test, &session, "first");
+    test_expect_read(test, &session, "third");
+    test_expect_empty(test, &session);
+
+    //the last one is still delayed
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchgroup_flush_delayed(entry, 0, U64_MAX, false), 1L);
+    mutex_unlock(&entry->group_lock);
+    test_expect_read(test, &session, "fourth");
+}
+
+//a huge delay of the group, as used to hold the messages until a flush, does not wrap around to the past
+static void synchmess_test_delay_saturated(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    u64 now = ktime_get_ns();
+
+    synchgroup_session_init(&session, entry);
+    KUNIT_EXPECT_EQ(test, synchmess_deadline_after(now, U64_MAX - 1), U64_MAX);
+    entry->timeout_millis = U64_MAX;
+    KUNIT_EXPECT_EQ(test, group_delay_deadline(entry, now), U64_MAX);
+    entry->timeout_millis = U64_MAX / NSEC_PER_MSEC;
+    KUNIT_EXPECT_EQ(test, group_delay_deadline(entry, now), U64_MAX);
+    entry->timeout_millis = 5;
+    KUNIT_EXPECT_EQ(test, group_delay_deadline(entry, now), now + 5 * NSEC_PER_MSEC);
+
+    entry->timeout_millis = U64_MAX;
+    KUNIT_ASSERT_EQ(test, test_send(entry, "held", -1, 0, false, group_delay_deadline(entry, ktime_get_ns())), 0);
+    KUNIT_EXPECT_EQ(test, entry->delayed, 1UL);
+    test_expect_empty(test, &session);
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchgroup_flush_delayed(entry, 0, U64_MAX, false), 1L);
+    mutex_unlock(&entry->group_lock);
+    test_expect_read(test, &session, "held");
+}
+
+static void synchmess_test_delayed_owner(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session reader;
+    struct synchgroup_session a;
+    struct synchgroup_session b;
+    //far enough that the delivery work does not run during the test
+    u64 base = ktime_get_ns() + 60 * NSEC_PER_SEC;
+
+    synchgroup_session_init(&reader, entry);
+    synchgroup_session_init(&a, entry);
+    synchgroup_session_init(&b, entry);
+    KUNIT_ASSERT_EQ(test, test_send_owned(entry, &a, "a3", base + 3), 0);
+    KUNIT_ASSERT_EQ(test, test_send_owned(entry, &a, "a1", base + 1), 0);
+    KUNIT_ASSERT_EQ(test, test_send_owned(entry, &b, "b2", base + 2), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "group", -1, 0, false, base + 4), 0);
+
+    //only the messages of a are stored, in deadline order
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchgroup_flush_session_delayed(&a, false), 2L);
+    KUNIT_EXPECT_EQ(test, entry->delayed, 2UL);
+    mutex_unlock(&entry->group_lock);
+    test_expect_read(test, &reader, "a1");
+    test_expect_read(test, &reader, "a3");
+    test_expect_empty(test, &reader);
+
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchgroup_flush_session_delayed(&b, true), 1L);
+    KUNIT_EXPECT_EQ(test, synchgroup_flush_session_delayed(&a, false), 0L);
+    KUNIT_EXPECT_EQ(test, entry->delayed, 1UL);
+    mutex_unlock(&entry->group_lock);
+    test_expect_empty(test, &reader);
+
+    //the messages of a closed file stay delayed in the group
+    KUNIT_ASSERT_EQ(test, test_send_owned(entry, &a, "a5", base + 5), 0);
+    mutex_lock(&entry->group_lock);
+    synchgroup_detach_session(&a);
+    KUNIT_EXPECT_TRUE(test, list_empty(&a.delayed));
+    KUNIT_EXPECT_EQ(test, synchgroup_flush_delayed(entry, 0, U64_MAX, false), 2L);
+    mutex_unlock(&entry->group_lock);
+    test_expect_read(test, &reader, "group");
+    test_expect_read(test, &reader, "a5");
+}
+
+static void synchmess_test_delivery(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    int i;
+
+    synchgroup_session_init(&session, entry);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "later", -1, 0, false, ktime_get_ns() + 20 * NSEC_PER_MSEC), 0);
+    test_expect_empty(test, &session);
+
+    //the delivery work stores the message after its deadline
+    for(i = 0; i < 100 && READ_ONCE(entry->message_list.lane_bitmap) == 0; i++){
+        msleep(10);
+    }
+    test_expect_read(test, &session, "later");
+}
+
+static void synchmess_test_reclaim(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    size_t bytes = 0;
+
+    synchgroup_session_init(&session, entry);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "drop", -1, 0, true, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "keep", -1, 0, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "later", -1, 0, true, ktime_get_ns() + 60 * NSEC_PER_SEC), 0);
+    KUNIT_EXPECT_EQ(test, entry->droppable, 2UL);
+
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchgroup_reclaim_messages(entry, 10, &bytes), 2UL);
+    mutex_unlock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, bytes, (size_t)9);
+    KUNIT_EXPECT_EQ(test, entry->droppable, 0UL);
+
+    test_expect_read(test, &session, "keep");
+    test_expect_empty(test, &session);
+}
+
+static void synchmess_test_restore(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    struct message_t *message;
+    struct message_t *delayed;
+    u64 deadline = ktime_get_ns() + 60 * NSEC_PER_SEC;
+
+    synchgroup_session_init(&session, entry);
+    synchmess_max_storage_size = 8;
+    message = synchmess_message_alloc(4, 0, false);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, message);
+    delayed = synchmess_message_alloc(5, 0, false);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, delayed);
+    memcpy(message->text, "aaaa", 4);
+    message->visible_ns = 42;
+
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchgroup_restore_message(entry, message, 3), 0);
+    KUNIT_EXPECT_EQ(test, message_partition(entry, message), 3);
+    //restored messages respect the storage limit, delayed ones are not stored yet
+    KUNIT_EXPECT_EQ(test, synchgroup_restore_message(entry, delayed, -1), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, synchgroup_restore_delayed(entry, delayed, -1, deadline), 0);
+    KUNIT_EXPECT_EQ(test, entry->delayed, 1UL);
+    mutex_unlock(&entry->group_lock);
+
+    session.partition_mask = 1UL << 3;
+    message = synchgroup_read_message(&session);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, message);
+    KUNIT_EXPECT_EQ(test, message->visible_ns, 42ULL);
+    message_free(message);
+}
+
+//records of a batch are a message_header and the body, each one starting at a multiple of 8 bytes
+static void synchmess_test_batch(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    struct message_t *message;
+    message_header header;
+    message_header *record;
+    char buf[2 * sizeof(message_header) + 16];
+    //bytes of the first record
+    size_t used = ALIGN(sizeof(message_header) + 5, 8);
+    size_t storage_bytes;
+
+    synchgroup_session_init(&session, entry);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "first", -1, 0, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "a longer message", -1, 0, false, 0), 0);
+
+    message = synchgroup_read_message_max(&session, sizeof(buf));
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, message);
+    memset(&header, 0, sizeof(header));
+    header.len = message->len;
+    header.seq = message->seq;
+    KUNIT_EXPECT_EQ(test, synchmess_batch_copy_message(&header, message->text, buf, sizeof(buf), true, synchmess_ring_copy_kernel), (ssize_t)used);
+    message_free(message);
+    record = (message_header *)buf;
+    KUNIT_EXPECT_EQ(test, record->len, 5U);
+    KUNIT_EXPECT_EQ(test, record->seq, 0ULL);
+    KUNIT_EXPECT_EQ(test, memcmp(buf + sizeof(header), "first", 5), 0);
+
+    //the second message does not fit in the rest of the buffer, it keeps its place and its storage
+    storage_bytes = entry->storage_bytes;
+    KUNIT_EXPECT_PTR_EQ(test, synchgroup_read_message_max(&session, sizeof(buf) - used - sizeof(header)), ERR_PTR(-EMSGSIZE));
+    KUNIT_EXPECT_EQ(test, entry->storage_bytes, storage_bytes);
+    KUNIT_EXPECT_EQ(test, entry->lane_depth[0], 1UL);
+    header.len = 16;
+    KUNIT_EXPECT_EQ(test, synchmess_batch_copy_message(&header, "a longer message", buf + used, sizeof(buf) - used, false, synchmess_ring_copy_kernel), (ssize_t)-EMSGSIZE);
+    KUNIT_EXPECT_EQ(test, synchmess_batch_copy_message(&header, "a longer message", buf, sizeof(header) - 1, false, synchmess_ring_copy_kernel), (ssize_t)-EMSGSIZE);
+
+    //only the first message of a batch is cut, and the header never is
+    KUNIT_EXPECT_EQ(test, synchmess_batch_copy_message(&header, "a longer message", buf, sizeof(header) - 1, true, synchmess_ring_copy_kernel), (ssize_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, synchmess_batch_copy_message(&header, "a longer message", buf, sizeof(header) + 3, true, synchmess_ring_copy_kernel), (ssize_t)(sizeof(header) + 3));
+    KUNIT_EXPECT_EQ(test, memcmp(buf + sizeof(header), "a l", 3), 0);
+    test_expect_read(test, &session, "a longer message");
+}
+
+//dump the group of the test to a kernel buffer and restore it in a second group
+static void synchmess_test_snapshot(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct group_dev *copy;
+    struct synchgroup_session session;
+    struct snapshot_stream stream;
+    snapshot_group record;
+    snapshot_info info;
+    char *buf;
+    size_t size;
+    u64 deadline = ktime_get_ns() + 60 * NSEC_PER_SEC;
+
+    KUNIT_ASSERT_EQ(test, test_send(entry, "first", 2, 1, false, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "second", -1, 0, true, 0), 0);
+    KUNIT_ASSERT_EQ(test, test_send(entry, "later", -1, 0, false, deadline), 0);
+    entry->timeout_millis = 7;
+    entry->read_header = true;
+    synchgroup_set_spin_budget(entry, 1000);
+
+    //a buffer too small still gives the size of the snapshot
+    KUNIT_ASSERT_EQ(test, synchmess_snapshot_stream_init(&stream, NULL, NULL, 0), 0);
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_dump_group(&stream, entry, "kunit"), 3UL);
+    mutex_unlock(&entry->group_lock);
+    synchmess_snapshot_stream_destroy(&stream);
+    KUNIT_EXPECT_EQ(test, stream.err, -ENOSPC);
+    size = stream.size;
+    KUNIT_EXPECT_EQ(test, size, sizeof(snapshot_group) + 3 * sizeof(snapshot_message) + strlen("first" "second" "later"));
+
+    buf = kunit_kzalloc(test, size, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+    KUNIT_ASSERT_EQ(test, synchmess_snapshot_stream_init(&stream, NULL, buf, size), 0);
+    mutex_lock(&entry->group_lock);
+    synchmess_snapshot_dump_group(&stream, entry, "kunit");
+    mutex_unlock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, stream.err, 0);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_flush(&stream), 0);
+    synchmess_snapshot_stream_destroy(&stream);
+
+    copy = kunit_kzalloc(test, sizeof(*copy), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, copy);
+    KUNIT_ASSERT_EQ(test, synchgroup_init(copy, "kunit-copy", 0), 0);
+    memset(&info, 0, sizeof(info));
+    KUNIT_ASSERT_EQ(test, synchmess_snapshot_stream_init(&stream, NULL, buf, size), 0);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_read(&stream, &record, sizeof(record)), 0);
+    KUNIT_EXPECT_STREQ(test, record.group.name, "kunit");
+    mutex_lock(&copy->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_restore_group(&stream, copy, SYNCHMESS_SNAPSHOT_VERSION, &record, &info), 0);
+    mutex_unlock(&copy->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_read_bytes(&stream), size);
+    synchmess_snapshot_stream_destroy(&stream);
+
+    KUNIT_EXPECT_EQ(test, info.messages, 3ULL);
+    KUNIT_EXPECT_EQ(test, info.dropped, 0ULL);
+    KUNIT_EXPECT_EQ(test, copy->timeout_millis, 7ULL);
+    KUNIT_EXPECT_TRUE(test, copy->read_header);
+    KUNIT_EXPECT_EQ(test, copy->spin_ns, 1000ULL);
+    KUNIT_EXPECT_EQ(test, copy->next_seq, entry->next_seq);
+    KUNIT_EXPECT_EQ(test, copy->delayed, 1UL);
+    synchgroup_session_init(&session, copy);
+    test_expect_read(test, &session, "first");
+    test_expect_read(test, &session, "second");
+    test_expect_empty(test, &session);
+    synchgroup_destroy(copy);
+}
+
+//a version 1 snapshot has shorter records, the missing fields are restored as 0
+static void synchmess_test_snapshot_v1(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    struct snapshot_stream stream;
+    struct message_t *message;
+    snapshot_group record;
+    snapshot_message message_record;
+    snapshot_info info;
+    char buf[SYNCHMESS_SNAPSHOT_V1_GROUP_SIZE + 2 * SYNCHMESS_SNAPSHOT_V1_MESSAGE_SIZE + 8];
+    size_t size;
+
+    memset(&record, 0, sizeof(record));
+    strscpy(record.group.name, "kunit", sizeof(record.group.name));
+    record.messages = 1;
+    memset(&message_record, 0, sizeof(message_record));
+    message_record.len = 3;
+    message_record.partition = -1;
+    memcpy(buf, &record, SYNCHMESS_SNAPSHOT_V1_GROUP_SIZE);
+    size = SYNCHMESS_SNAPSHOT_V1_GROUP_SIZE;
+    memcpy(buf + size, &message_record, SYNCHMESS_SNAPSHOT_V1_MESSAGE_SIZE);
+    size += SYNCHMESS_SNAPSHOT_V1_MESSAGE_SIZE;
+    memcpy(buf + size, "abc", 3);
+    size += 3;
+
+    synchgroup_session_init(&session, entry);
+    memset(&info, 0, sizeof(info));
+    KUNIT_ASSERT_EQ(test, synchmess_snapshot_stream_init(&stream, NULL, buf, size), 0);
+    memset(&record, 0, sizeof(record));
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_read(&stream, &record, snapshot_group_size(1)), 0);
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_restore_group(&stream, entry, 1, &record, &info), 0);
+    mutex_unlock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_read_bytes(&stream), size);
+    synchmess_snapshot_stream_destroy(&stream);
+    KUNIT_EXPECT_EQ(test, info.messages, 1ULL);
+    KUNIT_EXPECT_FALSE(test, entry->read_header);
+    KUNIT_EXPECT_EQ(test, entry->spin_ns, 0ULL);
+
+    message = synchgroup_read_message(&session);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, message);
+    KUNIT_EXPECT_STREQ(test, message->text, "abc");
+    KUNIT_EXPECT_EQ(test, message->seq, 0ULL);
+    message_free(message);
+
+    //a message longer than the storage of a group is rejected before its allocation
+    synchmess_max_storage_size = 2;
+    KUNIT_ASSERT_EQ(test, synchmess_snapshot_stream_init(&stream, NULL, buf, size), 0);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_read(&stream, &record, SYNCHMESS_SNAPSHOT_V1_GROUP_SIZE), 0);
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_restore_group(&stream, entry, 1, &record, &info), -EINVAL);
+    mutex_unlock(&entry->group_lock);
+    synchmess_snapshot_stream_destroy(&stream);
+
+    //a truncated snapshot is rejected
+    KUNIT_ASSERT_EQ(test, synchmess_snapshot_stream_init(&stream, NULL, buf, size - 1), 0);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_read(&stream, &record, SYNCHMESS_SNAPSHOT_V1_GROUP_SIZE), 0);
+    synchmess_max_storage_size = saved_max_storage_size;
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_restore_group(&stream, entry, 1, &record, &info), -EINVAL);
+    mutex_unlock(&entry->group_lock);
+    synchmess_snapshot_stream_destroy(&stream);
+}
+
+//message read from a ring by test_ring_read
+struct test_ring_buf {
+    char text[32];
+    u64 seq;
+};
+
+//ring_read_t copying the message to a test_ring_buf
+static ssize_t test_ring_read(void *data, const struct ring_record *record, const char *body){
+    struct test_ring_buf *buf = data;
+    size_t len = min_t(size_t, record->len, sizeof(buf->text) - 1);
+
+    memcpy(buf->text, body, len);
+    buf->text[len] = 0;
+    buf->seq = record->seq;
+    return len;
+}
+
+static void synchmess_test_ring(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    struct test_ring_buf buf;
+    char text[32];
+    int err;
+    int i;
+
+    synchgroup_session_init(&session, entry);
+    synchmess_max_storage_size = 64;
+    mutex_lock(&entry->group_lock);
+    err = synchgroup_set_ring(entry, true);
+    mutex_unlock(&entry->group_lock);
+    KUNIT_ASSERT_EQ(test, err, 0);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_read(entry, test_ring_read, &buf), (ssize_t)-ENODATA);
+
+    //the ring is strictly FIFO
+    KUNIT_EXPECT_EQ(test, test_send(entry, "keyed", 3, 0, false, 0), -EINVAL);
+    KUNIT_EXPECT_EQ(test, test_send(entry, "high", -1, 1, false, 0), -EINVAL);
+    //messages stored through the queues, as the delayed ones, end up in the ring
+    KUNIT_EXPECT_EQ(test, test_send(entry, "queued", -1, 0, false, 0), 0);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_read(entry, test_ring_read, &buf), (ssize_t)6);
+    KUNIT_EXPECT_STREQ(test, buf.text, "queued");
+    KUNIT_EXPECT_EQ(test, buf.seq, 2ULL);
+
+    //the quota still applies
+    memset(text, 'x', sizeof(text));
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_send(entry, text, 32, synchmess_ring_copy_kernel), 0);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_send(entry, text, 32, synchmess_ring_copy_kernel), 0);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_send(entry, text, 1, synchmess_ring_copy_kernel), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_read(entry, test_ring_read, &buf), (ssize_t)31);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_read(entry, test_ring_read, &buf), (ssize_t)31);
+    KUNIT_EXPECT_EQ(test, entry->storage_bytes, (size_t)0);
+
+    //the records go around the end of the ring many times, in FIFO order
+    for(i = 0; i < 1000; i++){
+        snprintf(text, sizeof(text), "message %d", i);
+        KUNIT_ASSERT_EQ(test, synchgroup_ring_send(entry, text, strlen(text), synchmess_ring_copy_kernel), 0);
+        if(i < 3){
+            continue;
+        }
+        KUNIT_ASSERT_GT(test, synchgroup_ring_read(entry, test_ring_read, &buf), (ssize_t)0);
+        snprintf(text, sizeof(text), "message %d", i - 3);
+        KUNIT_ASSERT_STREQ(test, buf.text, text);
+    }
+    KUNIT_EXPECT_EQ(test, entry->lane_depth[0], 3UL);
+
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_TRUE(test, synchgroup_has_messages(&session));
+    //the messages would be lost
+    KUNIT_EXPECT_EQ(test, synchgroup_set_ring(entry, false), -EBUSY);
+    //expired messages are removed from the head of the ring
+    entry->ttl_ns = 1;
+    ndelay(10);
+    synchgroup_expire_messages(entry);
+    KUNIT_EXPECT_EQ(test, entry->expired, 3UL);
+    KUNIT_EXPECT_EQ(test, synchgroup_set_ring(entry, false), 0);
+    mutex_unlock(&entry->group_lock);
+}
+
+//the ring is sized from max_storage_size and grows with it once it is empty
+static void synchmess_test_ring_size(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct test_ring_buf buf;
+    int err;
+    int i;
+
+    synchmess_max_storage_size = PAGE_SIZE / RING_SIZE_FACTOR;
+    mutex_lock(&entry->group_lock);
+    err = synchgroup_set_ring(entry, true);
+    mutex_unlock(&entry->group_lock);
+    KUNIT_ASSERT_EQ(test, err, 0);
+    KUNIT_EXPECT_EQ(test, entry->ring_size, (size_t)PAGE_SIZE);
+
+    //the headers of messages of 1 byte fill the ring long before the quota
+    for(i = 0; synchgroup_ring_send(entry, "a", 1, synchmess_ring_copy_kernel) == 0; i++);
+    KUNIT_EXPECT_EQ(test, i, (int)(PAGE_SIZE / RING_RECORD_SIZE(1)));
+    KUNIT_EXPECT_LT(test, entry->storage_bytes, (size_t)synchmess_max_storage_size);
+
+    //a ring in use is not resized
+    synchmess_max_storage_size = PAGE_SIZE;
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_send(entry, "a", 1, synchmess_ring_copy_kernel), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, entry->ring_size, (size_t)PAGE_SIZE);
+    while(synchgroup_ring_read(entry, test_ring_read, &buf) > 0);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_send(entry, "a", 1, synchmess_ring_copy_kernel), 0);
+    KUNIT_EXPECT_EQ(test, entry->ring_size, (size_t)PAGE_SIZE * RING_SIZE_FACTOR);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_read(entry, test_ring_read, &buf), (ssize_t)1);
+    KUNIT_EXPECT_STREQ(test, buf.text, "a");
+
+    //without a quota the ring still gets a page
+    synchmess_max_storage_size = 0;
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchgroup_set_ring(entry, false), 0);
+    KUNIT_EXPECT_EQ(test, synchgroup_set_ring(entry, true), 0);
+    mutex_unlock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, entry->ring_size, (size_t)PAGE_SIZE);
+}
+
+//ring_read_t sending a message to the ring and expiring the messages while it copies one
+static ssize_t test_ring_read_send(void *data, const struct ring_record *record, const char *body){
+    struct group_dev *entry = data;
+    
+    //group_lock is free while a message is copied
+    if(synchgroup_ring_send(entry, "sent", 4, synchmess_ring_copy_kernel)){
+        return -EIO;
+    }
+    mutex_lock(&entry->group_lock);
+    entry->ttl_ns = 1;
+    ndelay(10);
+    synchgroup_expire_messages(entry);
+    entry->ttl_ns = 0;
+    mutex_unlock(&entry->group_lock);
+    return record->len;
+}
+
+//a message of the ring is copied without group_lock, and stays in place until it is copied
+static void synchmess_test_ring_read_unlocked(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct test_ring_buf buf;
+    int err;
+
+    synchmess_max_storage_size = 64;
+    mutex_lock(&entry->group_lock);
+    err = synchgroup_set_ring(entry, true);
+    mutex_unlock(&entry->group_lock);
+    KUNIT_ASSERT_EQ(test, err, 0);
+    KUNIT_ASSERT_EQ(test, synchgroup_ring_send(entry, "first", 5, synchmess_ring_copy_kernel), 0);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_read(entry, test_ring_read_send, entry), (ssize_t)5);
+    //the message being copied was not expired, the one sent meanwhile is still there
+    KUNIT_EXPECT_EQ(test, entry->expired, 0UL);
+    KUNIT_EXPECT_EQ(test, synchgroup_ring_read(entry, test_ring_read, &buf), (ssize_t)4);
+    KUNIT_EXPECT_STREQ(test, buf.text, "sent");
+    KUNIT_EXPECT_EQ(test, entry->storage_bytes, (size_t)0);
+}
+
+//thread sleeping on the barrier of a group
+struct barrier_sleeper {
+    struct group_dev *entry;
+    struct completion done;
+};
+
+static int barrier_sleeper_fn(void *data){
+    struct barrier_sleeper *sleeper = data;
+
+    synchgroup_barrier_sleep(sleeper->entry);
+    complete(&sleeper->done);
+    return 0;
+}
+
+static void synchmess_test_barrier(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct barrier_sleeper sleeper;
+    struct task_struct *task;
+    int i;
+
+    sleeper.entry = entry;
+    init_completion(&sleeper.done);
+    task = kthread_run(barrier_sleeper_fn, &sleeper, "synchmess_kunit");
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, task);
+
+    for(i = 0; i < 1000 && !waitqueue_active(&entry->sleep_queue); i++){
+        msleep(1);
+    }
+    KUNIT_EXPECT_TRUE(test, waitqueue_active(&entry->sleep_queue));
+    KUNIT_EXPECT_FALSE(test, completion_done(&sleeper.done));
+
+    synchgroup_barrier_awake(entry);
+    KUNIT_EXPECT_EQ(test, entry->barrier_generation, 1UL);
+    KUNIT_EXPECT_NE(test, wait_for_completion_timeout(&sleeper.done, 5 * HZ), 0UL);
+}
+
+static bool test_spin_ready(void *data){
+    return *(bool *)data;
+}
+
+static void synchmess_test_barrier_spin(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    struct barrier_sleeper sleeper;
+    struct task_struct *task;
+    bool ready;
+    int probes = 0;
+    int i;
+
+    ready = true;
+    KUNIT_EXPECT_TRUE(test, synchmess_spin(NSEC_PER_SEC, test_spin_ready, &ready));
+    ready = false;
+    KUNIT_EXPECT_FALSE(test, synchmess_spin(1000, test_spin_ready, &ready));
+
+    //without a release within the budget the waiter sleeps after spinning
+    entry->spin_ns = 1000;
+    sleeper.entry = entry;
+    init_completion(&sleeper.done);
+    task = kthread_run(barrier_sleeper_fn, &sleeper, "synchmess_kunit");
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, task);
+    for(i = 0; i < 1000 && !waitqueue_active(&entry->sleep_queue); i++){
+        msleep(1);
+    }
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&entry->spin_attempts), 1L);
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&entry->spin_hits), 0L);
+    synchgroup_barrier_awake(entry);
+    KUNIT_EXPECT_NE(test, wait_for_completion_timeout(&sleeper.done, 5 * HZ), 0UL);
+
+    //after many spins without a release only one waiter in SPIN_PROBE_INTERVAL spins
+    for(i = 0; i < 16; i++){
+        synchgroup_spin_end(entry, false);
+    }
+    KUNIT_EXPECT_LT(test, entry->spin_rate, (unsigned int)SPIN_RATE_MIN);
+    for(i = 0; i < 2 * SPIN_PROBE_INTERVAL; i++){
+        if(synchgroup_spin_begin(entry)){
+            synchgroup_spin_end(entry, false);
+            probes++;
+        }
+    }
+    KUNIT_EXPECT_EQ(test, probes, 2);
+    //a few hits are enough to spin again
+    for(i = 0; i < 4; i++){
+        synchgroup_spin_end(entry, true);
+    }
+    KUNIT_EXPECT_TRUE(test, synchgroup_spin_begin(entry));
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&entry->spin_hits), 4L);
+}
+
+static struct kunit_case synchmess_test_cases[] = {
+    KUNIT_CASE(synchmess_test_fifo),
+    KUNIT_CASE(synchmess_test_priority),
+    KUNIT_CASE(synchmess_test_partitions),
+    KUNIT_CASE(synchmess_test_storage_full),
+    KUNIT_CASE(synchmess_test_sequence),
+    KUNIT_CASE(synchmess_test_ttl),
+    KUNIT_CASE(synchmess_test_delayed),
+    KUNIT_CASE(synchmess_test_delay_saturated),
+    KUNIT_CASE(synchmess_test_delayed_owner),
+    KUNIT_CASE(synchmess_test_delivery),
+    KUNIT_CASE(synchmess_test_reclaim),
+    KUNIT_CASE(synchmess_test_restore),
+    KUNIT_CASE(synchmess_test_batch),
+    KUNIT_CASE(synchmess_test_snapshot),
+    KUNIT_CASE(synchmess_test_snapshot_v1),
+    KUNIT_CASE(synchmess_test_ring),
+    KUNIT_CASE(synchmess_test_ring_size),
+    KUNIT_CASE(synchmess_test_ring_read_unlocked),
+    KUNIT_CASE(synchmess_test_barrier),
+    KUNIT_CASE(synchmess_test_barrier_spin),
+    {}
+};
+
+static struct kunit_suite synchmess_test_suite = {
+    .name = "synchmess",
+    .init = synchmess_test_init,
+    .exit = synchmess_test_exit,
+    .test_cases = synchmess_test_cases,
+};
+
+//Microbenchmarks, the results are reported in the KUnit log as ns per operation
+
+//operations timed by each measure
+#define BENCH_OPS 4096
+//body of the messages, as the demo programs
+#define BENCH_MESSAGE_LEN 16
+
+//number of messages already in the group when an operation is timed
+static const unsigned long bench_depths[] = { 1, 64, 1024, 16384 };
+//number of threads sharing the group
+static const unsigned long bench_threads[] = { 1, 2, 4, 8 };
+//number of messages of a restored snapshot, up to the 1M messages restored "well under a second"
+static const unsigned long bench_snapshots[] = { 1024, 65536, 1048576 };
+
+//body sizes of the storage benchmark
+static const unsigned long bench_sizes[] = { 16, 32, 64, 128, 256 };
+
+static void bench_size_desc(const unsigned long *len, char *desc){
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%lu bytes", *len);
+}
+
+static void bench_depth_desc(const unsigned long *depth, char *desc){
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "depth %lu", *depth);
+}
+
+static void bench_threads_desc(const unsigned long *threads, char *desc){
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%lu threads", *threads);
+}
+
+static void bench_snapshot_desc(const unsigned long *nr, char *desc){
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%lu messages", *nr);
+}
+
+KUNIT_ARRAY_PARAM(bench_depth, bench_depths, bench_depth_desc);
+KUNIT_ARRAY_PARAM(bench_threads, bench_threads, bench_threads_desc);
+KUNIT_ARRAY_PARAM(bench_size, bench_sizes, bench_size_desc);
+KUNIT_ARRAY_PARAM(bench_snapshot, bench_snapshots, bench_snapshot_desc);
+
+static int synchmess_bench_init(struct kunit *test){
+    int err = synchmess_test_init(test);
+
+    //the groups of the benchmarks never reach the storage limit
+    synchmess_max_storage_size = INT_MAX;
+    return err;
+}
+
+//send a message of BENCH_MESSAGE_LEN bytes, deadline 0 means no delay
+static int bench_send(struct group_dev *entry, int partition, u64 deadline){
+    struct message_t *message;
+
+    message = synchmess_message_alloc(BENCH_MESSAGE_LEN, 0, false);
+    if(message == NULL){
+        return -ENOMEM;
+    }
+    memset(message->text, 'x', BENCH_MESSAGE_LEN);
+    return synchgroup_send_message(entry, message, partition, deadline, NULL);
+}
+
+//read and free up to nr messages, returns the number of messages read
+static unsigned long bench_drain(struct synchgroup_session *session, unsigned long nr){
+    struct message_t *message;
+    unsigned long i;
+
+    for(i = 0; i < nr; i++){
+        message = synchgroup_read_message(session);
+        if(IS_ERR_OR_NULL(message)){
+            break;
+        }
+        message_free(message);
+    }
+    return i;
+}
+
+//enqueue and dequeue of stored messages, with depth messages in the queue
+static void synchmess_bench_enqueue_dequeue(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    const unsigned long *depth = test->param_value;
+    struct synchgroup_session session;
+    unsigned long i;
+    u64 start;
+    u64 enqueue_ns;
+    u64 dequeue_ns;
+
+    synchgroup_session_init(&session, entry);
+    for(i = 0; i < *depth; i++){
+        KUNIT_ASSERT_EQ(test, bench_send(entry, -1, 0), 0);
+    }
+
+    start = ktime_get_ns();
+    for(i = 0; i < BENCH_OPS; i++){
+        KUNIT_ASSERT_EQ(test, bench_send(entry, -1, 0), 0);
+    }
+    enqueue_ns = ktime_get_ns() - start;
+
+    start = ktime_get_ns();
+    KUNIT_EXPECT_EQ(test, bench_drain(&session, BENCH_OPS), (unsigned long)BENCH_OPS);
+    dequeue_ns = ktime_get_ns() - start;
+
+    kunit_info(test, "depth %lu: enqueue %llu ns/op, dequeue %llu ns/op\n", *depth, div_u64(enqueue_ns, BENCH_OPS), div_u64(dequeue_ns, BENCH_OPS));
+}
+
+//insert depth delayed messages and then flush (or revoke) all of them
+static void bench_flush(struct kunit *test, bool revoke){
+    struct group_dev *entry = test->priv;
+    const unsigned long *depth = test->param_value;
+    struct synchgroup_session session;
+    //far enough that the delivery work does not run during the benchmark
+    u64 base = ktime_get_ns() + 60 * NSEC_PER_SEC;
+    unsigned long i;
+    long flushed;
+    u64 start;
+    u64 insert_ns;
+    u64 flush_ns;
+
+    synchgroup_session_init(&session, entry);
+    start = ktime_get_ns();
+    for(i = 0; i < *depth; i++){
+        KUNIT_ASSERT_EQ(test, bench_send(entry, -1, base + i), 0);
+    }
+    insert_ns = ktime_get_ns() - start;
+
+    start = ktime_get_ns();
+    mutex_lock(&entry->group_lock);
+    flushed = synchgroup_flush_delayed(entry, 0, U64_MAX, revoke);
+    synchgroup_arm_delivery(entry);
+    mutex_unlock(&entry->group_lock);
+    flush_ns = ktime_get_ns() - start;
+
+    KUNIT_EXPECT_EQ(test, flushed, (long)*depth);
+    KUNIT_EXPECT_EQ(test, bench_drain(&session, *depth), revoke ? 0UL : *depth);
+    kunit_info(test, "depth %lu: delay %llu ns/op, %s %llu ns/op\n", *depth, div_u64(insert_ns, *depth), revoke ? "revoke" : "flush", div_u64(flush_ns, *depth));
+}
+
+static void synchmess_bench_flush(struct kunit *test){
+    bench_flush(test, false);
+}
+
+static void synchmess_bench_revoke(struct kunit *test){
+    bench_flush(test, true);
+}
+
+//thread sending and reading BENCH_OPS messages on a shared group
+struct bench_worker {
+    struct group_dev *entry;
+    int err;
+    struct completion done;
+};
+
+static int bench_worker_fn(void *data){
+    struct bench_worker *worker = data;
+    struct synchgroup_session session;
+    struct message_t *message;
+    int i;
+
+    synchgroup_session_init(&session, worker->entry);
+    worker->err = 0;
+    for(i = 0; i < BENCH_OPS && worker->err == 0; i++){
+        worker->err = bench_send(worker->entry, -1, 0);
+        //the message read may be the one of another thread
+        message = synchgroup_read_message(&session);
+        if(!IS_ERR_OR_NULL(message)){
+            message_free(message);
+        }
+    }
+    complete(&worker->done);
+    return 0;
+}
+
+//enqueue/dequeue pairs by concurrent threads, they all contend on group_lock
+static void synchmess_bench_threads(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    const unsigned long *threads = test->param_value;
+    struct synchgroup_session session;
+    struct bench_worker *workers;
+    struct task_struct *task;
+    unsigned long started = 0;
+    unsigned long i;
+    u64 start;
+    u64 elapsed_ns;
+
+    workers = kunit_kcalloc(test, *threads, sizeof(*workers), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, workers);
+
+    start = ktime_get_ns();
+    for(i = 0; i < *threads; i++){
+        workers[i].entry = entry;
+        init_completion(&workers[i].done);
+        task = kthread_run(bench_worker_fn, &workers[i], "synchmess_bench/%lu", i);
+        if(IS_ERR(task)){
+            break;
+        }
+        started++;
+    }
+    for(i = 0; i < started; i++){
+        wait_for_completion(&workers[i].done);
+        KUNIT_EXPECT_EQ(test, workers[i].err, 0);
+    }
+    elapsed_ns = ktime_get_ns() - start;
+    KUNIT_ASSERT_EQ(test, started, *threads);
+
+    synchgroup_session_init(&session, entry);
+    bench_drain(&session, ULONG_MAX);
+    kunit_info(test, "%lu threads on %u cpus: enqueue+dequeue %llu ns/op\n", *threads, num_online_cpus(), div_u64(elapsed_ns, *threads * BENCH_OPS));
+}
+
+//messages stored by the storage benchmark, enough to go beyond the caches closest to the cpu
+#define BENCH_STORAGE_MESSAGES 16384
+
+//counter of the cache misses of the current thread, NULL when the hardware has none (as on UML)
+static struct perf_event *bench_cache_misses_start(void){
+#ifdef CONFIG_PERF_EVENTS
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .config = PERF_COUNT_HW_CACHE_MISSES,
+        .size = sizeof(attr),
+        .exclude_hv = 1,
+    };
+    struct perf_event *event;
+
+    event = perf_event_create_kernel_counter(&attr, -1, current, NULL, NULL);
+    if(!IS_ERR(event)){
+        return event;
+    }
+#endif
+    return NULL;
+}
+
+//cache misses since bench_cache_misses_start, U64_MAX when they are not counted
+static u64 bench_cache_misses_stop(struct perf_event *event){
+#ifdef CONFIG_PERF_EVENTS
+    u64 enabled;
+    u64 running;
+    u64 count;
+
+    if(event != NULL){
+        count = perf_event_read_value(event, &enabled, &running);
+        perf_event_release_kernel(event);
+        return count;
+    }
+#endif
+    return U64_MAX;
+}
+
+//cost of BENCH_STORAGE_MESSAGES enqueues and dequeues
+struct bench_storage_result {
+    u64 enqueue_ns;
+    u64 enqueue_misses;
+    u64 dequeue_ns;
+    u64 dequeue_misses;
+};
+
+//ring_read_t copying the message to a kernel buffer, as read copies it to the user
+static ssize_t bench_ring_read(void *data, const struct ring_record *record, const char *body){
+    memcpy(data, body, record->len);
+    return record->len;
+}
+
+//fill the group with messages of len bytes and drain it, through the queues or through the ring.
+//The body is copied from and to kernel buffers where write and read copy from and to the user
+static void bench_storage(struct kunit *test, bool ring, size_t len, struct bench_storage_result *result){
+    struct group_dev *entry = test->priv;
+    struct synchgroup_session session;
+    struct message_t *message;
+    struct perf_event *event;
+    char *in;
+    char *out;
+    unsigned long i;
+    int err = 0;
+    u64 start;
+
+    in = kunit_kzalloc(test, len, GFP_KERNEL);
+    out = kunit_kzalloc(test, len, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, in);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, out);
+    memset(in, 'x', len);
+    synchgroup_session_init(&session, entry);
+    mutex_lock(&entry->group_lock);
+    err = synchgroup_set_ring(entry, ring);
+    mutex_unlock(&entry->group_lock);
+    KUNIT_ASSERT_EQ(test, err, 0);
+
+    event = bench_cache_misses_start();
+    start = ktime_get_ns();
+    for(i = 0; i < BENCH_STORAGE_MESSAGES && err == 0; i++){
+        if(ring){
+            err = synchgroup_ring_send(entry, in, len, synchmess_ring_copy_kernel);
+            continue;
+        }
+        message = synchmess_message_alloc(len, 0, false);
+        if(message == NULL){
+            err = -ENOMEM;
+            break;
+        }
+        memcpy(message->text, in, len);
+        err = synchgroup_send_message(entry, message, -1, 0, NULL);
+    }
+    result->enqueue_ns = ktime_get_ns() - start;
+    result->enqueue_misses = bench_cache_misses_stop(event);
+    KUNIT_ASSERT_EQ(test, err, 0);
+
+    event = bench_cache_misses_start();
+    start = ktime_get_ns();
+    for(i = 0; i < BENCH_STORAGE_MESSAGES; i++){
+        if(ring){
+            if(synchgroup_ring_read(entry, bench_ring_read, out) < 0){
+                break;
+            }
+            continue;
+        }
+        message = synchgroup_read_message(&session);
+        if(IS_ERR_OR_NULL(message)){
+            break;
+        }
+        memcpy(out, message->text, message->len);
+        message_free(message);
+    }
+    result->dequeue_ns = ktime_get_ns() - start;
+    result->dequeue_misses = bench_cache_misses_stop(event);
+    KUNIT_ASSERT_EQ(test, i, (unsigned long)BENCH_STORAGE_MESSAGES);
+
+    mutex_lock(&entry->group_lock);
+    synchgroup_set_ring(entry, false);
+    mutex_unlock(&entry->group_lock);
+}
+
+static void bench_storage_report(struct kunit *test, const char *backend, size_t len, struct bench_storage_result *result){
+    if(result->enqueue_misses == U64_MAX || result->dequeue_misses == U64_MAX){
+        kunit_info(test, "%zu bytes, %s: enqueue %llu ns/op, dequeue %llu ns/op, cache misses not available\n", len, backend,
+            div_u64(result->enqueue_ns, BENCH_STORAGE_MESSAGES), div_u64(result->dequeue_ns, BENCH_STORAGE_MESSAGES));
+        return;
+    }
+    kunit_info(test, "%zu bytes, %s: enqueue %llu ns/op %llu misses/100 ops, dequeue %llu ns/op %llu misses/100 ops\n", len, backend,
+        div_u64(result->enqueue_ns, BENCH_STORAGE_MESSAGES), div_u64(result->enqueue_misses * 100, BENCH_STORAGE_MESSAGES),
+        div_u64(result->dequeue_ns, BENCH_STORAGE_MESSAGES), div_u64(result->dequeue_misses * 100, BENCH_STORAGE_MESSAGES));
+}
+
+//queues of separately allocated messages against the contiguous ring, for the same messages
+static void synchmess_bench_storage(struct kunit *test){
+    const unsigned long *len = test->param_value;
+    struct bench_storage_result list;
+    struct bench_storage_result ring;
+
+    //the ring is sized from the quota when it is enabled
+    synchmess_max_storage_size = BENCH_STORAGE_MESSAGES * *len;
+    bench_storage(test, false, *len, &list);
+    bench_storage(test, true, *len, &ring);
+    bench_storage_report(test, "list", *len, &list);
+    bench_storage_report(test, "ring", *len, &ring);
+}
+
+//restore of a snapshot of a group with nr messages from a kernel buffer, then dump of the group to the same buffer
+static void synchmess_bench_snapshot(struct kunit *test){
+    struct group_dev *entry = test->priv;
+    const unsigned long *nr = test->param_value;
+    struct snapshot_stream stream;
+    snapshot_group record;
+    snapshot_message message_record;
+    snapshot_info info;
+    size_t record_size = sizeof(message_record) + BENCH_MESSAGE_LEN;
+    size_t size = sizeof(record) + *nr * record_size;
+    unsigned long i;
+    char *buf;
+    u64 start;
+    u64 restore_ns;
+    u64 dump_ns;
+
+    buf = vmalloc(size);
+    if(buf == NULL){
+        kunit_skip(test, "no memory for a snapshot of %zu bytes", size);
+        return;
+    }
+    memset(&record, 0, sizeof(record));
+    strscpy(record.group.name, "kunit", sizeof(record.group.name));
+    record.messages = *nr;
+    memcpy(buf, &record, sizeof(record));
+    memset(&message_record, 0, sizeof(message_record));
+    message_record.len = BENCH_MESSAGE_LEN;
+    message_record.partition = -1;
+    for(i = 0; i < *nr; i++){
+        message_record.seq = i;
+        memcpy(buf + sizeof(record) + i * record_size, &message_record, sizeof(message_record));
+        memset(buf + sizeof(record) + i * record_size + sizeof(message_record), 'x', BENCH_MESSAGE_LEN);
+    }
+
+    memset(&info, 0, sizeof(info));
+    if(synchmess_snapshot_stream_init(&stream, NULL, buf, size)){
+        vfree(buf);
+        KUNIT_FAIL(test, "no memory for the stream");
+        return;
+    }
+    start = ktime_get_ns();
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_read(&stream, &record, sizeof(record)), 0);
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_restore_group(&stream, entry, SYNCHMESS_SNAPSHOT_VERSION, &record, &info), 0);
+    mutex_unlock(&entry->group_lock);
+    restore_ns = ktime_get_ns() - start;
+    synchmess_snapshot_stream_destroy(&stream);
+    KUNIT_EXPECT_EQ(test, info.messages, (unsigned long long)*nr);
+
+    if(synchmess_snapshot_stream_init(&stream, NULL, buf, size)){
+        vfree(buf);
+        KUNIT_FAIL(test, "no memory for the stream");
+        return;
+    }
+    start = ktime_get_ns();
+    mutex_lock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_dump_group(&stream, entry, "kunit"), *nr);
+    mutex_unlock(&entry->group_lock);
+    KUNIT_EXPECT_EQ(test, synchmess_snapshot_flush(&stream), 0);
+    dump_ns = ktime_get_ns() - start;
+    KUNIT_EXPECT_EQ(test, stream.size, size);
+    synchmess_snapshot_stream_destroy(&stream);
+    vfree(buf);
+
+    kunit_info(test, "%lu messages: restore %llu us (%llu ns/message), dump %llu us (%llu ns/message)\n", *nr,
+        div_u64(restore_ns, NSEC_PER_USEC), div_u64(restore_ns, *nr), div_u64(dump_ns, NSEC_PER_USEC), div_u64(dump_ns, *nr));
+}
+
+static struct kunit_case synchmess_bench_cases[] = {
+    KUNIT_CASE_PARAM(synchmess_bench_enqueue_dequeue, bench_depth_gen_params),
+    KUNIT_CASE_PARAM(synchmess_bench_flush, bench_depth_gen_params),
+    KUNIT_CASE_PARAM(synchmess_bench_revoke, bench_depth_gen_params),
+    KUNIT_CASE_PARAM(synchmess_bench_threads, bench_threads_gen_params),
+    KUNIT_CASE_PARAM(synchmess_bench_storage, bench_size_gen_params),
+    KUNIT_CASE_PARAM(synchmess_bench_snapshot, bench_snapshot_gen_params),
+    {}
+};
+
+static struct kunit_suite synchmess_bench_suite = {
+    .name = "synchmess-bench",
+    .init = synchmess_bench_init,
+    .exit = synchmess_test_exit,
+    .test_cases = synchmess_bench_cases,
+};
+
+kunit_test_suites(&synchmess_test_suite, &synchmess_bench_suite);